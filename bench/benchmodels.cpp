@@ -0,0 +1,48 @@
+/*
+ * benchmodels.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "benchmodels.h"
+
+Teacher::Teacher() : QModel("bench_teacher")
+{
+    name = stringField("name");
+
+    init();
+}
+
+Course::Course() : QModel("bench_course")
+{
+    name = stringField("name");
+    teacher = foreignKey<Teacher>("teacher");
+    pupils = reverseRelation<Pupil>("course");
+
+    init();
+}
+
+Pupil::Pupil() : QModel("bench_pupil")
+{
+    name = stringField("name");
+    age = intField("age");
+    course = foreignKey<Course>("course");
+
+    init();
+}
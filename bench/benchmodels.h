@@ -0,0 +1,59 @@
+/*
+ * benchmodels.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __BENCHMODELS_H__
+#define __BENCHMODELS_H__
+
+#include "qmodel.h"
+
+/*
+ * Models used by the benchmarks: a pupil follows a course given by a teacher
+ */
+
+struct Teacher : public QModel
+{
+    Teacher();
+
+    QStringField name;
+};
+
+struct Pupil;
+
+struct Course : public QModel
+{
+    Course();
+
+    QStringField name;
+    QForeignKey<Teacher> teacher;
+    QReverseRelation<Pupil> pupils;
+};
+
+struct Pupil : public QModel
+{
+    Pupil();
+
+    QStringField name;
+    QIntField age;
+    QForeignKey<Course> course;
+};
+
+#endif
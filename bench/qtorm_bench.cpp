@@ -0,0 +1,583 @@
+/*
+ * qtorm_bench.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * End-to-end benchmark of the hot paths of QtORM, against an in-memory and a
+ * file-backed SQLite database. The results are printed as JSON:
+ *
+ *   qtorm_bench [--iterations N] [--output file.json]
+ */
+
+#include "benchmodels.h"
+#include "qqueryset.h"
+#include "qtormdatabase.h"
+#include "qtormstats.h"
+#include "qtormjson_p.h"
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QSet>
+#include <QFile>
+#include <QDir>
+#include <QtSql>
+#include <QtDebug>
+#include <QtAlgorithms>
+
+#include <stdio.h>
+
+#define TEACHERS 10
+#define COURSES 50
+#define PUPILS 10000
+#define ROWS_PER_QUERY 100
+
+/*
+ * Measurements
+ */
+
+class Run
+{
+    public:
+        Run(const QString &backend, const QString &name, int iterations, int rowsPerOp = 1)
+         : backend(backend), name(name), iterations(iterations), rowsPerOp(rowsPerOp),
+           allocations(0), allocated_bytes(0)
+        {
+            samples.reserve(iterations);
+        }
+
+        void start()
+        {
+            start_allocs = QtOrmStats::totalAllocations();
+            timer.start();
+        }
+
+        void stop()
+        {
+            samples.append(timer.nsecsElapsed());
+
+            QtOrmStats::Allocations allocs = QtOrmStats::totalAllocations();
+
+            allocations += allocs.count - start_allocs.count;
+            allocated_bytes += allocs.bytes - start_allocs.bytes;
+        }
+
+        qint64 percentile(double p) const
+        {
+            // samples are sorted by toJson()
+            int i = int(p * samples.count());
+
+            return samples.at(qMin(i, samples.count() - 1));
+        }
+
+        QString toJson()
+        {
+            qint64 total = 0;
+
+            qSort(samples);
+
+            for (int i=0; i<samples.count(); ++i)
+                total += samples.at(i);
+
+            double ops_per_sec = (total ? samples.count() * 1e9 / total : 0.0);
+            QString allocs;
+
+            // Only available when QtORM is built with QTORM_ALLOC_STATS
+            if (QtOrmStats::hasAllocationStats())
+            {
+                double rows = double(samples.count()) * rowsPerOp;
+
+                allocs = QString(", \"allocs_per_row\": %1, \"bytes_per_row\": %2, \"allocs_counted\": %3")
+                    .arg(allocations / rows, 0, 'f', 2)
+                    .arg(allocated_bytes / rows, 0, 'f', 1)
+                    .arg(qtormJsonString(QLatin1String(QtOrmStats::allocationHook())));
+            }
+
+            return QString("{\"backend\": %1, \"name\": %2, \"iterations\": %3, \"rows_per_op\": %4, "
+                           "\"ops_per_sec\": %5, \"rows_per_sec\": %6, "
+                           "\"p50_ns\": %7, \"p90_ns\": %8, \"p99_ns\": %9, \"max_ns\": %10%11}")
+                .arg(qtormJsonString(backend))
+                .arg(qtormJsonString(name))
+                .arg(samples.count())
+                .arg(rowsPerOp)
+                .arg(ops_per_sec, 0, 'f', 1)
+                .arg(ops_per_sec * rowsPerOp, 0, 'f', 1)
+                .arg(percentile(0.5))
+                .arg(percentile(0.9))
+                .arg(percentile(0.99))
+                .arg(samples.last())
+                .arg(allocs);
+        }
+
+    public:
+        QString backend, name;
+        int iterations, rowsPerOp;
+
+    private:
+        QElapsedTimer timer;
+        QVector<qint64> samples;
+        QtOrmStats::Allocations start_allocs;
+        qint64 allocations, allocated_bytes;
+};
+
+static QList<QVariant> pupil_ids;
+
+static void exec(QSqlDatabase db, const QString &sql)
+{
+    QSqlQuery query(db);
+
+    if (!query.exec(sql))
+        qDebug() << "Cannot run" << sql << ":" << query.lastError();
+}
+
+static void populate(QSqlDatabase db)
+{
+    Teacher t;
+    Course c;
+    Pupil p;
+
+    exec(db, t.createTableSql());
+    exec(db, c.createTableSql());
+    exec(db, p.createTableSql());
+
+    db.transaction();
+
+    QList<QVariant> teacher_ids, course_ids;
+
+    for (int i=0; i<TEACHERS; ++i)
+    {
+        t.pk().setRawData(QVariant());
+        t.name = QString("teacher %1").arg(i);
+        t.save();
+        teacher_ids.append(t.pk().data());
+    }
+
+    for (int i=0; i<COURSES; ++i)
+    {
+        c.pk().setRawData(QVariant());
+        c.name = QString("course %1").arg(i);
+        c.teacher = teacher_ids.at(i % TEACHERS);
+        c.save();
+        course_ids.append(c.pk().data());
+    }
+
+    pupil_ids.clear();
+
+    for (int i=0; i<PUPILS; ++i)
+    {
+        p.pk().setRawData(QVariant());
+        p.name = QString("pupil %1").arg(i);
+        p.age = 6 + i % 12;
+        p.course = course_ids.at(i % COURSES);
+        p.save();
+        pupil_ids.append(p.pk().data());
+    }
+
+    db.commit();
+}
+
+/*
+ * Benchmarks
+ */
+
+static void benchSave(Run &run)
+{
+    Pupil p;
+
+    p.name = QString("new pupil");
+    p.age = 10;
+    p.course = QVariant(1);
+
+    for (int i=0; i<run.iterations; ++i)
+    {
+        p.pk().setRawData(QVariant());
+
+        run.start();
+        p.save();
+        run.stop();
+    }
+}
+
+static void benchSaveBatch(Run &run)
+{
+    Pupil p;
+
+    for (int i=0; i<run.iterations; ++i)
+    {
+        // saveBatch() sets the primary key to the last inserted id
+        p.clearBatch();
+        p.pk().setRawData(QVariant());
+
+        for (int j=0; j<run.rowsPerOp; ++j)
+        {
+            p.name = QString("batch pupil %1").arg(j);
+            p.age = j % 12;
+            p.course = QVariant(1 + j % COURSES);
+            p.addInBatch();
+        }
+
+        run.start();
+        p.saveBatch();
+        run.stop();
+    }
+}
+
+static void benchSelectRelated(Run &run)
+{
+    Pupil p;
+
+    for (int i=0; i<run.iterations; ++i)
+    {
+        run.start();
+
+        QQuerySet q(&p);
+
+        q.addSelectRelated(p.course->teacher);
+        q.setOffset((i * ROWS_PER_QUERY) % PUPILS);
+        q.setLimit(ROWS_PER_QUERY);
+
+        while (q.next())
+            ;
+
+        run.stop();
+    }
+}
+
+static void benchFilter(Run &run)
+{
+    Pupil p;
+
+    for (int i=0; i<run.iterations; ++i)
+    {
+        run.start();
+
+        QQuerySet q(&p);
+
+        q.addFilter(QF(p.age) >= 8 &&
+                    (QF(p.name).like("pupil 1%") || QF(p.course->name) == QString("course %1").arg(i % COURSES)) &&
+                    !QF(p.course->teacher->name).isNull());
+        q.setLimit(ROWS_PER_QUERY);
+
+        while (q.next())
+            ;
+
+        run.stop();
+    }
+}
+
+static void benchUpdate(Run &run)
+{
+    Pupil p;
+
+    p.age = QF(p.age) + QVariant(1);
+
+    for (int i=0; i<run.iterations; ++i)
+    {
+        run.start();
+
+        QQuerySet u(&p);
+
+        u.addFilter(QF(p.pk()) == pupil_ids.at(i % pupil_ids.count()));
+        u.update();
+
+        run.stop();
+    }
+}
+
+static void benchForeignKey(Run &run)
+{
+    Pupil p;
+    QQuerySet q(&p);
+
+    // Without addSelectRelated, every dereference of a new course is a query
+    q.setLimit(run.iterations);
+
+    while (q.next())
+    {
+        run.start();
+        QString name = p.course->name;
+        run.stop();
+
+        Q_UNUSED(name);
+    }
+}
+
+static void benchExists(Run &run)
+{
+    Course c;
+    Pupil p;
+
+    for (int i=0; i<run.iterations; ++i)
+    {
+        run.start();
+
+        // Courses followed by at least one pupil older than 16, in one statement
+        QQuerySet q(&c);
+
+        q.addFilter(QF(c.pk()).exists(p.course, QF(p.age) > 16));
+
+        while (q.next())
+            ;
+
+        run.stop();
+    }
+}
+
+static void benchExistsClientSide(Run &run)
+{
+    Course c;
+    Pupil p;
+
+    for (int i=0; i<run.iterations; ++i)
+    {
+        run.start();
+
+        // The same courses, found by iterating the pupils
+        QQuerySet pupils(&p);
+        QSet<int> ids;
+
+        pupils.addField(p.course);
+        pupils.addFilter(QF(p.age) > 16);
+
+        while (pupils.next())
+            ids.insert(p.course.data().toInt());
+
+        QVariantList list;
+
+        for (QSet<int>::const_iterator it = ids.constBegin(); it != ids.constEnd(); ++it)
+            list.append(*it);
+
+        QQuerySet q(&c);
+
+        q.addFilter(QF(c.pk()).in(list));
+
+        while (q.next())
+            ;
+
+        run.stop();
+    }
+}
+
+static void benchReverseRelation(Run &run, bool prefetch)
+{
+    Course c;
+
+    for (int i=0; i<run.iterations; ++i)
+    {
+        run.start();
+
+        // Pupils of every course, in one query per chunk of courses or one per course
+        QQuerySet q(&c);
+        int pupils = 0;
+
+        if (prefetch)
+            q.addPrefetchRelated(c.pupils);
+
+        while (q.next())
+            pupils += c.pupils.count();
+
+        run.stop();
+
+        Q_UNUSED(pupils);
+    }
+}
+
+static void benchInList(Run &run, QWhere::InListStrategy strategy)
+{
+    Pupil p;
+    QVariantList ids;
+
+    for (int i=0; i<run.rowsPerOp; ++i)
+        ids.append(pupil_ids.at(i % pupil_ids.count()));
+
+    // The threshold only matters for the temporary table
+    QWhere::setInListStrategy(strategy, 0);
+
+    for (int i=0; i<run.iterations; ++i)
+    {
+        run.start();
+
+        QQuerySet q(&p);
+
+        q.addField(p.pk());
+        q.addFilter(QF(p.pk()).in(ids));
+
+        while (q.next())
+            ;
+
+        run.stop();
+    }
+
+    QWhere::setInListStrategy(QWhere::InAutomatic);
+}
+
+/*
+ * Main
+ */
+
+static void runBackend(const QString &backend, const QString &databaseName, int iterations, QStringList &results)
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "qtorm_bench_" + backend);
+
+    db.setDatabaseName(databaseName);
+
+    if (!db.open())
+    {
+        qDebug() << "Cannot open" << databaseName << ":" << db.lastError();
+        return;
+    }
+
+    QtOrmDatabase::setPerThreadDatabase(true);
+    QtOrmDatabase::setThreadDatabase(db);
+
+    populate(db);
+
+    Run save(backend, "save", iterations);
+    benchSave(save);
+    results.append(save.toJson());
+
+    // A pupil binds 3 values, SQLite limits statements to 999 parameters
+    int batch_sizes[] = {10, 100, 300};
+
+    for (unsigned i=0; i<sizeof(batch_sizes) / sizeof(int); ++i)
+    {
+        int size = batch_sizes[i];
+        Run batch(backend, QString("save_batch_%1").arg(size), qMax(10, iterations * 10 / size), size);
+
+        benchSaveBatch(batch);
+        results.append(batch.toJson());
+    }
+
+    Run select_related(backend, "select_related", iterations, ROWS_PER_QUERY);
+    benchSelectRelated(select_related);
+    results.append(select_related.toJson());
+
+    Run filter(backend, "filter", iterations, ROWS_PER_QUERY);
+    benchFilter(filter);
+    results.append(filter.toJson());
+
+    Run update(backend, "update", iterations);
+    benchUpdate(update);
+    results.append(update.toJson());
+
+    Run exists(backend, "exists", iterations, COURSES / 2);
+    benchExists(exists);
+    results.append(exists.toJson());
+
+    Run exists_client(backend, "exists_client_side", iterations, COURSES / 2);
+    benchExistsClientSide(exists_client);
+    results.append(exists_client.toJson());
+
+    Run prefetch(backend, "reverse_prefetch", iterations, COURSES);
+    benchReverseRelation(prefetch, true);
+    results.append(prefetch.toJson());
+
+    Run per_row(backend, "reverse_per_row", iterations, COURSES);
+    benchReverseRelation(per_row, false);
+    results.append(per_row.toJson());
+
+    int in_sizes[] = {100, 900, 10000};
+
+    for (unsigned i=0; i<sizeof(in_sizes) / sizeof(int); ++i)
+    {
+        int size = in_sizes[i];
+        int in_iterations = qMax(10, iterations * 100 / size);
+
+        // SQLite limits statements to 999 parameters
+        if (size < 999)
+        {
+            Run placeholders(backend, QString("in_placeholders_%1").arg(size), in_iterations, size);
+
+            benchInList(placeholders, QWhere::InPlaceholders);
+            results.append(placeholders.toJson());
+        }
+
+        Run table(backend, QString("in_temporary_table_%1").arg(size), in_iterations, size);
+
+        benchInList(table, QWhere::InTemporaryTable);
+        results.append(table.toJson());
+    }
+
+    Run foreign_key(backend, "foreign_key_value", qMin(iterations, PUPILS));
+    benchForeignKey(foreign_key);
+    results.append(foreign_key.toJson());
+
+    // Release the connection before removing it
+    QtOrmDatabase::setThreadDatabase(QSqlDatabase());
+    db.close();
+    db = QSqlDatabase();
+    QSqlDatabase::removeDatabase("qtorm_bench_" + backend);
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    QString output;
+    int iterations = 1000;
+
+    for (int i=1; i<args.count(); ++i)
+    {
+        if (args.at(i) == "--iterations" && i + 1 < args.count())
+            iterations = qMax(1, args.at(++i).toInt());
+        else if (args.at(i) == "--output" && i + 1 < args.count())
+            output = args.at(++i);
+        else
+        {
+            fprintf(stderr, "Usage: %s [--iterations N] [--output file.json]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    QStringList results;
+    QString file_name = QDir::temp().filePath("qtorm_bench.sqlite");
+
+    runBackend("sqlite-memory", ":memory:", iterations, results);
+
+    QFile::remove(file_name);
+    runBackend("sqlite-file", file_name, iterations, results);
+    QFile::remove(file_name);
+
+    QByteArray json = QString("{\"iterations\": %1, \"results\": [\n  %2\n]}\n")
+        .arg(iterations)
+        .arg(results.join(",\n  "))
+        .toUtf8();
+
+    if (output.isEmpty())
+    {
+        fwrite(json.constData(), 1, json.size(), stdout);
+    }
+    else
+    {
+        QFile file(output);
+
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            qDebug() << "Cannot write" << output << ":" << file.errorString();
+            return 1;
+        }
+
+        file.write(json);
+    }
+
+    return 0;
+}
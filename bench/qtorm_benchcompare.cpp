@@ -0,0 +1,414 @@
+/*
+ * qtorm_benchcompare.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Compare two result files of qtorm_bench or qtorm_sqlbench, and exit with 1
+ * if a benchmark regressed by more than the noise threshold:
+ *
+ *   qtorm_benchcompare baseline.json current.json [--threshold percent]
+ *                      [--threshold name=percent] [--alloc-threshold percent]
+ */
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QVariant>
+#include <QHash>
+#include <QFile>
+#include <QtDebug>
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Minimal JSON parser, Qt 4 has none
+ */
+
+class JsonParser
+{
+    public:
+        JsonParser(const QString &text) : _text(text), _pos(0), _error(false) {}
+
+        QVariant parse()
+        {
+            QVariant rs = value();
+
+            skipSpaces();
+
+            if (_pos != _text.size())
+                _error = true;
+
+            return rs;
+        }
+
+        bool hasError() const
+        {
+            return _error;
+        }
+
+    private:
+        void skipSpaces()
+        {
+            while (_pos < _text.size() && _text.at(_pos).isSpace())
+                _pos++;
+        }
+
+        bool consume(QChar c)
+        {
+            skipSpaces();
+
+            if (_pos < _text.size() && _text.at(_pos) == c)
+            {
+                _pos++;
+                return true;
+            }
+
+            return false;
+        }
+
+        QVariant value()
+        {
+            skipSpaces();
+
+            if (_pos >= _text.size())
+            {
+                _error = true;
+                return QVariant();
+            }
+
+            QChar c = _text.at(_pos);
+
+            if (c == QLatin1Char('{'))
+                return object();
+            else if (c == QLatin1Char('['))
+                return array();
+            else if (c == QLatin1Char('"'))
+                return string();
+            else if (literal("true"))
+                return true;
+            else if (literal("false"))
+                return false;
+            else if (literal("null"))
+                return QVariant();
+            else
+                return number();
+        }
+
+        bool literal(const char *word)
+        {
+            QLatin1String str(word);
+            int size = int(strlen(word));
+
+            if (_text.mid(_pos, size) != str)
+                return false;
+
+            _pos += size;
+            return true;
+        }
+
+        QVariant object()
+        {
+            QVariantMap rs;
+
+            _pos++;     // {
+
+            if (consume(QLatin1Char('}')))
+                return rs;
+
+            do
+            {
+                skipSpaces();
+                QString key = string().toString();
+
+                if (!consume(QLatin1Char(':')))
+                {
+                    _error = true;
+                    return rs;
+                }
+
+                rs.insert(key, value());
+            } while (!_error && consume(QLatin1Char(',')));
+
+            if (!consume(QLatin1Char('}')))
+                _error = true;
+
+            return rs;
+        }
+
+        QVariant array()
+        {
+            QVariantList rs;
+
+            _pos++;     // [
+
+            if (consume(QLatin1Char(']')))
+                return rs;
+
+            do
+            {
+                rs.append(value());
+            } while (!_error && consume(QLatin1Char(',')));
+
+            if (!consume(QLatin1Char(']')))
+                _error = true;
+
+            return rs;
+        }
+
+        QVariant string()
+        {
+            QString rs;
+
+            if (_pos >= _text.size() || _text.at(_pos) != QLatin1Char('"'))
+            {
+                _error = true;
+                return rs;
+            }
+
+            _pos++;
+
+            while (_pos < _text.size() && _text.at(_pos) != QLatin1Char('"'))
+            {
+                QChar c = _text.at(_pos++);
+
+                if (c != QLatin1Char('\\') || _pos >= _text.size())
+                {
+                    rs += c;
+                    continue;
+                }
+
+                c = _text.at(_pos++);
+
+                if (c == QLatin1Char('n'))
+                    rs += QLatin1Char('\n');
+                else if (c == QLatin1Char('t'))
+                    rs += QLatin1Char('\t');
+                else if (c == QLatin1Char('u'))
+                {
+                    rs += QChar(_text.mid(_pos, 4).toUShort(0, 16));
+                    _pos += 4;
+                }
+                else
+                    rs += c;    // \" \\ \/
+            }
+
+            if (_pos >= _text.size())
+                _error = true;
+
+            _pos++;     // "
+
+            return rs;
+        }
+
+        QVariant number()
+        {
+            int start = _pos;
+
+            while (_pos < _text.size() && QString("+-0123456789.eE").contains(_text.at(_pos)))
+                _pos++;
+
+            bool ok;
+            double rs = _text.mid(start, _pos - start).toDouble(&ok);
+
+            if (!ok)
+                _error = true;
+
+            return rs;
+        }
+
+    private:
+        QString _text;
+        int _pos;
+        bool _error;
+};
+
+/*
+ * Comparison
+ */
+
+struct Metric
+{
+    const char *name;
+    bool higher_is_better;
+    bool allocations;           // Deterministic, compared with their own threshold
+};
+
+static const Metric metrics[] = {
+    {"ops_per_sec", true, false},
+    {"ns_per_query", false, false},
+    {"allocs_per_row", false, true},
+    {"allocs_per_query", false, true}
+};
+
+static bool readResults(const QString &fileName, QHash<QString, QVariantMap> &results)
+{
+    QFile file(fileName);
+
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        fprintf(stderr, "Cannot read %s\n", qPrintable(fileName));
+        return false;
+    }
+
+    QByteArray data = file.readAll();
+    JsonParser parser(QString::fromUtf8(data.constData(), data.size()));
+    QVariant root = parser.parse();
+
+    if (parser.hasError())
+    {
+        fprintf(stderr, "Invalid JSON in %s\n", qPrintable(fileName));
+        return false;
+    }
+
+    QVariantList list = root.toMap().value("results").toList();
+
+    for (int i=0; i<list.count(); ++i)
+    {
+        QVariantMap result = list.at(i).toMap();
+
+        results.insert(result.value("backend").toString() + "/" + result.value("name").toString(), result);
+    }
+
+    return true;
+}
+
+static int usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s baseline.json current.json [--threshold percent] "
+                    "[--threshold name=percent] [--alloc-threshold percent] [--allow-missing]\n", argv0);
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    QStringList files;
+    QHash<QString, double> thresholds;      // Per benchmark name
+    double default_threshold = 10.0;
+    double alloc_threshold = 1.0;
+    bool allow_missing = false;             // Benchmarks removed on purpose
+
+    for (int i=1; i<args.count(); ++i)
+    {
+        const QString &arg = args.at(i);
+
+        if (arg == "--threshold" && i + 1 < args.count())
+        {
+            QString value = args.at(++i);
+            int equal = value.indexOf('=');
+
+            if (equal == -1)
+                default_threshold = value.toDouble();
+            else
+                thresholds.insert(value.left(equal), value.mid(equal + 1).toDouble());
+        }
+        else if (arg == "--alloc-threshold" && i + 1 < args.count())
+        {
+            alloc_threshold = args.at(++i).toDouble();
+        }
+        else if (arg == "--allow-missing")
+        {
+            allow_missing = true;
+        }
+        else if (!arg.startsWith("--"))
+        {
+            files.append(arg);
+        }
+        else
+        {
+            return usage(argv[0]);
+        }
+    }
+
+    if (files.count() != 2)
+        return usage(argv[0]);
+
+    QHash<QString, QVariantMap> baseline, current;
+
+    if (!readResults(files.at(0), baseline) || !readResults(files.at(1), current))
+        return 2;
+
+    QStringList keys = baseline.keys();
+    int regressions = 0;
+    int missing = 0;
+
+    qSort(keys);
+
+    for (int i=0; i<keys.count(); ++i)
+    {
+        const QString &key = keys.at(i);
+        const QVariantMap &base = baseline.value(key);
+
+        if (!current.contains(key))
+        {
+            // A benchmark that crashed or was skipped must not pass silently
+            printf("%-40s missing from %s%s\n", qPrintable(key), qPrintable(files.at(1)),
+                   allow_missing ? "" : "  MISSING");
+            missing++;
+            continue;
+        }
+
+        const QVariantMap &cur = current.value(key);
+        QString name = base.value("name").toString();
+
+        for (unsigned m=0; m<sizeof(metrics) / sizeof(Metric); ++m)
+        {
+            const Metric &metric = metrics[m];
+
+            if (!base.contains(metric.name) || !cur.contains(metric.name))
+                continue;
+
+            double before = base.value(metric.name).toDouble();
+            double after = cur.value(metric.name).toDouble();
+            double threshold = metric.allocations ? alloc_threshold : thresholds.value(name, default_threshold);
+
+            double change = (before == 0.0 ? (after == 0.0 ? 0.0 : 100.0) : (after - before) * 100.0 / before);
+            double worse = (metric.higher_is_better ? -change : change);
+            const char *verdict = "ok";
+
+            if (worse > threshold)
+            {
+                verdict = "REGRESSION";
+                regressions++;
+            }
+            else if (worse < -threshold)
+            {
+                verdict = "improved";
+            }
+
+            printf("%-40s %-18s %14.2f %14.2f %+8.1f%%  %s\n",
+                   qPrintable(key), metric.name, before, after, change, verdict);
+        }
+    }
+
+    if (regressions)
+        printf("\n%d regression(s) above the noise threshold\n", regressions);
+
+    if (missing && !allow_missing)
+        printf("\n%d benchmark(s) missing from %s, use --allow-missing if they were removed\n",
+               missing, qPrintable(files.at(1)));
+
+    if (regressions || (missing && !allow_missing))
+        return 1;
+
+    return 0;
+}
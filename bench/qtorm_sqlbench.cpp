@@ -0,0 +1,402 @@
+/*
+ * qtorm_sqlbench.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Microbenchmark of the SQL generation: QWhere trees and QQuerySet statements
+ * are built against a stub driver that never talks to a database, so that only
+ * the work done by QtORM is measured. Prints JSON:
+ *
+ *   qtorm_sqlbench [--iterations N] [--output file.json]
+ */
+
+#include "benchmodels.h"
+#include "qqueryset.h"
+#include "qtormdatabase.h"
+#include "qtormjson_p.h"
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QtSql>
+#include <QtDebug>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+/*
+ * Allocation counting, the benchmark is single-threaded
+ */
+
+static unsigned long long allocations = 0;
+
+static unsigned long long allocationCount()
+{
+    return allocations;
+}
+
+#if defined(__GLIBC__)
+
+/*
+ * The Qt containers allocate with qMalloc(), that calls malloc(): replace the
+ * malloc family so that QString and QVector are counted too
+ */
+
+static const char *allocationHook()
+{
+    return "malloc";
+}
+
+extern "C"
+{
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+}
+
+#else
+
+// Only operator new can be replaced portably, the Qt containers are missed
+static const char *allocationHook()
+{
+    return "operator new";
+}
+
+#if __cplusplus >= 201103L
+#define THROW_BAD_ALLOC
+#else
+#define THROW_BAD_ALLOC throw(std::bad_alloc)
+#endif
+
+void *operator new(size_t size) THROW_BAD_ALLOC
+{
+    void *rs = malloc(size ? size : 1);
+
+    if (!rs)
+        throw std::bad_alloc();
+
+    allocations++;
+    return rs;
+}
+
+void *operator new[](size_t size) THROW_BAD_ALLOC
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) throw()
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) throw()
+{
+    free(ptr);
+}
+
+#if defined(__cpp_sized_deallocation)
+void operator delete(void *ptr, size_t) throw()
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) throw()
+{
+    free(ptr);
+}
+#endif
+
+#endif
+
+/*
+ * Stub driver, prepares everything and returns no rows
+ */
+
+class StubResult : public QSqlResult
+{
+    public:
+        StubResult(const QSqlDriver *driver) : QSqlResult(driver) {}
+
+    protected:
+        QVariant data(int) { return QVariant(); }
+        bool isNull(int) { return true; }
+        bool reset(const QString &) { return true; }
+        bool fetch(int) { return false; }
+        bool fetchFirst() { return false; }
+        bool fetchLast() { return false; }
+        int size() { return 0; }
+        int numRowsAffected() { return 0; }
+};
+
+class StubDriver : public QSqlDriver
+{
+    public:
+        bool hasFeature(DriverFeature feature) const
+        {
+            return feature == PreparedQueries || feature == PositionalPlaceholders;
+        }
+
+        bool open(const QString &, const QString &, const QString &, const QString &, int, const QString &)
+        {
+            setOpen(true);
+            setOpenError(false);
+            return true;
+        }
+
+        void close()
+        {
+            setOpen(false);
+        }
+
+        QSqlResult *createResult() const
+        {
+            return new StubResult(this);
+        }
+
+        QString escapeIdentifier(const QString &identifier, IdentifierType) const
+        {
+            // Like QSQLITE, "T0"."name" for T0.name
+            QString rs = identifier;
+
+            rs.replace(QLatin1Char('"'), QLatin1String("\"\""));
+            rs.replace(QLatin1Char('.'), QLatin1String("\".\""));
+
+            return QLatin1Char('"') + rs + QLatin1Char('"');
+        }
+};
+
+/*
+ * Measurements
+ */
+
+class Case
+{
+    public:
+        Case(const QString &name) : _name(name) {}
+        virtual ~Case() {}
+
+        QString name() const { return _name; }
+        virtual void run(int iteration) = 0;
+
+    private:
+        QString _name;
+};
+
+// Format a filter tree and collect its values
+class WhereCase : public Case
+{
+    public:
+        WhereCase(const QString &name, const QWhere &where, QSqlDriver *driver)
+         : Case(name), _where(where), _driver(driver) {}
+
+        void run(int)
+        {
+            QVariantList values;
+
+            _sql = _where.sql(_driver);
+            _where.bindValues(values, _driver);
+        }
+
+    private:
+        QWhere _where;
+        QSqlDriver *_driver;
+        QString _sql;
+};
+
+// Build the statement of a new queryset, like a point query would
+class QuerySetCase : public Case
+{
+    public:
+        QuerySetCase(const QString &name, Pupil *model, int joinDepth, bool tree)
+         : Case(name), _model(model), _join_depth(joinDepth), _tree(tree) {}
+
+        void run(int iteration)
+        {
+            QQuerySet q(_model);
+
+            if (_join_depth == 1)
+                q.addSelectRelated(_model->course);
+            else if (_join_depth == 2)
+                q.addSelectRelated(_model->course->teacher);
+
+            if (_tree)
+                q.addFilter(QF(_model->age) >= 8 &&
+                            (QF(_model->name).like("pupil 1%") || QF(_model->course->name) == QString("course 3")));
+
+            q.addFilter(QF(_model->pk()) == iteration);
+            q.setLimit(1);
+
+            _sql = q.sql();
+        }
+
+    private:
+        Pupil *_model;
+        int _join_depth;
+        bool _tree;
+        QString _sql;
+};
+
+static QString measure(Case *c, int iterations)
+{
+    QElapsedTimer timer;
+    qint64 best = -1;
+    unsigned long long allocs = 0;
+
+    // Warm the statement cache and the allocator
+    for (int i=0; i<qMin(iterations, 100); ++i)
+        c->run(i);
+
+    // Best of 5 rounds, per-iteration timing would cost more than a query
+    for (int round=0; round<5; ++round)
+    {
+        unsigned long long start_allocs = allocationCount();
+
+        timer.start();
+
+        for (int i=0; i<iterations; ++i)
+            c->run(i);
+
+        qint64 elapsed = timer.nsecsElapsed();
+
+        allocs = allocationCount() - start_allocs;
+
+        if (best == -1 || elapsed < best)
+            best = elapsed;
+    }
+
+    return QString("{\"backend\": \"stub\", \"name\": %1, \"iterations\": %2, "
+                   "\"ns_per_query\": %3, \"allocs_per_query\": %4, \"allocs_counted\": %5}")
+        .arg(qtormJsonString(c->name()))
+        .arg(iterations)
+        .arg(double(best) / iterations, 0, 'f', 1)
+        .arg(double(allocs) / iterations, 0, 'f', 2)
+        .arg(qtormJsonString(QLatin1String(allocationHook())));
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    QString output;
+    int iterations = 100000;
+
+    for (int i=1; i<args.count(); ++i)
+    {
+        if (args.at(i) == "--iterations" && i + 1 < args.count())
+            iterations = qMax(1, args.at(++i).toInt());
+        else if (args.at(i) == "--output" && i + 1 < args.count())
+            output = args.at(++i);
+        else
+        {
+            fprintf(stderr, "Usage: %s [--iterations N] [--output file.json]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // The driver is owned by the connection
+    StubDriver *driver = new StubDriver;
+    QSqlDatabase db = QSqlDatabase::addDatabase(driver, "qtorm_sqlbench");
+
+    db.open();
+
+    QtOrmDatabase::setPerThreadDatabase(true);
+    QtOrmDatabase::setThreadDatabase(db);
+
+    // One model per join depth, as following a foreign key instantiates its model for good
+    Pupil where_model, point_model, join1_model, join2_model;
+    QVariantList ids;
+
+    for (int i=0; i<100; ++i)
+        ids.append(i);
+
+    QList<Case *> cases;
+
+    cases.append(new WhereCase("where_equal", QF(where_model.age) == 10, driver));
+    cases.append(new WhereCase("where_tree",
+                               (QF(where_model.age) >= 8 && QF(where_model.age) < 12) &&
+                               (QF(where_model.name).like("pupil 1%") || QF(where_model.course->name) == QString("course 3")) &&
+                               !QF(where_model.course->teacher->name).isNull(),
+                               driver));
+    cases.append(new WhereCase("where_in_100", QF(where_model.pk()).in(ids), driver));
+    cases.append(new QuerySetCase("queryset_point", &point_model, 0, false));
+    cases.append(new QuerySetCase("queryset_join_1", &join1_model, 1, false));
+    cases.append(new QuerySetCase("queryset_join_2_tree", &join2_model, 2, true));
+
+    QStringList results;
+
+    for (int i=0; i<cases.count(); ++i)
+    {
+        results.append(measure(cases.at(i), iterations));
+        delete cases.at(i);
+    }
+
+    QByteArray json = QString("{\"iterations\": %1, \"results\": [\n  %2\n]}\n")
+        .arg(iterations)
+        .arg(results.join(",\n  "))
+        .toUtf8();
+
+    if (output.isEmpty())
+    {
+        fwrite(json.constData(), 1, json.size(), stdout);
+    }
+    else
+    {
+        QFile file(output);
+
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            qDebug() << "Cannot write" << output << ":" << file.errorString();
+            return 1;
+        }
+
+        file.write(json);
+    }
+
+    return 0;
+}
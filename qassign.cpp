@@ -23,9 +23,11 @@
 #include "qassign.h"
 #include "qfield.h"
 #include "qf.h"
+#include "qtormfootprint_p.h"
 
 #include <QtDebug>
 #include <QSqlDriver>
+#include <QAtomicInt>
 
 class QAssignPrivate
 {
@@ -40,9 +42,10 @@ class QAssignPrivate
 
         virtual QString sql(QSqlDriver *driver) const = 0;
         virtual void bindValues(QVariantList &values) const = 0;
+        virtual qint64 heapSize() const = 0;
 
     private:
-        unsigned int _refcount;
+        QAtomicInt _refcount;
 };
 
 class QFAssignPrivate : public QAssignPrivate
@@ -53,6 +56,7 @@ class QFAssignPrivate : public QAssignPrivate
 
         QString sql(QSqlDriver *driver) const;
         void bindValues(QVariantList &values) const;
+        qint64 heapSize() const;
 
     private:
         QField _f;
@@ -66,6 +70,7 @@ class QIAssignPrivate : public QAssignPrivate
 
         QString sql(QSqlDriver *driver) const;
         void bindValues(QVariantList &values) const;
+        qint64 heapSize() const;
 
     private:
         QVariant _value;
@@ -79,6 +84,7 @@ class QOpAssignPrivate : public QAssignPrivate
 
         QString sql(QSqlDriver *driver) const;
         void bindValues(QVariantList &values) const;
+        qint64 heapSize() const;
 
     private:
         QAssign _left;
@@ -101,14 +107,12 @@ QString QAssignPrivate::fieldName(const QField& field, QSqlDriver *driver) const
 
 void QAssignPrivate::ref()
 {
-    _refcount++;
+    _refcount.ref();
 }
 
 bool QAssignPrivate::deref()
 {
-    _refcount--;
-
-    return (_refcount != 0);
+    return _refcount.deref();
 }
 
 QAssign::QAssign() : d(NULL)
@@ -125,24 +129,27 @@ QAssign::QAssign(QAssignPrivate* d) : d(d)
 {
 }
 
-QAssign::QAssign(const QVariant& value) : d(new QIAssignPrivate(value))
+QAssign::QAssign(const QVariant& value)
 {
+    d = new QIAssignPrivate(value);
 }
 
-QAssign::QAssign(const QF& f) : d(new QFAssignPrivate(f.field()))
+QAssign::QAssign(const QF& f)
 {
+    d = new QFAssignPrivate(f.field());
 }
 
 QAssign &QAssign::operator=(const QAssign &other)
 {
-    if (d && d->deref())
+    // Reference the new tree first, so that self-assignment is safe
+    if (other.d)
+        other.d->ref();
+
+    if (d && !d->deref())
         delete d;
 
     d = other.d;
 
-    if (d)
-        d->ref();
-
     return *this;
 }
 
@@ -157,6 +164,22 @@ bool QAssign::isValid() const
     return (d != NULL);
 }
 
+#if defined(__GXX_EXPERIMENTAL_CXX0X__)
+QAssign &QAssign::operator=(QAssign &&other)
+{
+    if (this != &other)
+    {
+        if (d && !d->deref())
+            delete d;
+
+        d = other.d;
+        other.d = nullptr;
+    }
+
+    return *this;
+}
+#endif
+
 QString QAssign::operationStr(QAssign::Operation op)
 {
     switch (op)
@@ -179,6 +202,11 @@ void QAssign::bindValues(QVariantList& values) const
     d->bindValues(values);
 }
 
+qint64 QAssign::heapSize() const
+{
+    return d ? d->heapSize() : 0;
+}
+
 QString QAssign::sql(QSqlDriver *driver) const
 {
     return d->sql(driver);
@@ -221,6 +249,11 @@ void QFAssignPrivate::bindValues(QVariantList& values) const
     return;
 }
 
+qint64 QFAssignPrivate::heapSize() const
+{
+    return sizeof(*this);
+}
+
 QString QFAssignPrivate::sql(QSqlDriver *driver) const
 {
     return fieldName(_f, driver);
@@ -242,6 +275,11 @@ void QIAssignPrivate::bindValues(QVariantList& values) const
     values.append(_value);
 }
 
+qint64 QIAssignPrivate::heapSize() const
+{
+    return sizeof(*this) + qtormHeapSize(_value);
+}
+
 QString QIAssignPrivate::sql(QSqlDriver *driver) const
 {
     (void) driver;
@@ -275,6 +313,11 @@ void QOpAssignPrivate::bindValues(QVariantList &values) const
     _right.bindValues(values);
 }
 
+qint64 QOpAssignPrivate::heapSize() const
+{
+    return sizeof(*this) + _left.heapSize() + _right.heapSize();
+}
+
 QOpAssign::QOpAssign(const QAssign& left, const QAssign& right, QAssign::Operation op)
 : QAssign(new QOpAssignPrivate(left, right, op))
 {
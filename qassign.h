@@ -55,15 +55,7 @@ class QAssign
             d = other.d; other.d = nullptr;
         }
 
-        inline QAssign &operator=(QAssign &&other)
-        {
-            if (this != &other)
-            {
-                d = other.d;
-                other.d = nullptr;
-            }
-            return *this;
-        }
+        QAssign &operator=(QAssign &&other);
 #endif
 
         bool isValid() const;
@@ -78,6 +70,7 @@ class QAssign
     public:
         QString sql(QSqlDriver *driver) const;
         void bindValues(QVariantList &values) const;
+        qint64 heapSize() const;   /*!< @brief Approximate heap bytes held by the expression tree */
 
     private:
         QAssignPrivate *d;
@@ -22,6 +22,7 @@
 
 #include "qdatetimefield.h"
 #include "qfield_p.h"
+#include "qtormfootprint_p.h"
 
 class QDateTimeFieldPrivate : public QFieldPrivate
 {
@@ -34,6 +35,7 @@ class QDateTimeFieldPrivate : public QFieldPrivate
         void fromData(const QVariant &data);
         QVariant data() const;
         QString sqlDescription() const;
+        qint64 heapSize() const;
 
     private:
         QDateTime _datetime;
@@ -81,6 +83,13 @@ QString QDateTimeFieldPrivate::sqlDescription() const
     return rs;
 }
 
+qint64 QDateTimeFieldPrivate::heapSize() const
+{
+    // QDateTime points to a QDateTimePrivate : reference count, date, time,
+    // spec and UTC offset
+    return sizeof(*this) + commonHeapSize() + 5 * sizeof(int);
+}
+
 /*
  * QDateTimeField
  */
@@ -22,6 +22,7 @@
 
 #include "qdoublefield.h"
 #include "qfield_p.h"
+#include "qtormfootprint_p.h"
 
 class QDoubleFieldPrivate : public QFieldPrivate
 {
@@ -34,6 +35,7 @@ class QDoubleFieldPrivate : public QFieldPrivate
         void fromData(const QVariant &data);
         QVariant data() const;
         QString sqlDescription() const;
+        qint64 heapSize() const;
 
     private:
         double _value;
@@ -81,6 +83,11 @@ QString QDoubleFieldPrivate::sqlDescription() const
     return rs;
 }
 
+qint64 QDoubleFieldPrivate::heapSize() const
+{
+    return sizeof(*this) + commonHeapSize();
+}
+
 /*
  * QDoubleField
  */
@@ -28,8 +28,9 @@ struct QF::Private
     QField f;
 };
 
-QF::QF(const QField& f) : d(new Private)
+QF::QF(const QField& f)
 {
+    d = new Private;
     d->f = f;
 }
 
@@ -103,6 +104,36 @@ QWhere QF::operator>=(const QField &other) const
     return QFFWhere(d->f, other, QWhere::GreaterEqual);
 }
 
+QWhere QF::operator==(QQuerySet &subquery) const
+{
+    return QFSubqueryWhere(d->f, subquery, QWhere::Equal);
+}
+
+QWhere QF::operator!=(QQuerySet &subquery) const
+{
+    return QFSubqueryWhere(d->f, subquery, QWhere::NotEqual);
+}
+
+QWhere QF::operator<(QQuerySet &subquery) const
+{
+    return QFSubqueryWhere(d->f, subquery, QWhere::Less);
+}
+
+QWhere QF::operator>(QQuerySet &subquery) const
+{
+    return QFSubqueryWhere(d->f, subquery, QWhere::Greater);
+}
+
+QWhere QF::operator<=(QQuerySet &subquery) const
+{
+    return QFSubqueryWhere(d->f, subquery, QWhere::LessEqual);
+}
+
+QWhere QF::operator>=(QQuerySet &subquery) const
+{
+    return QFSubqueryWhere(d->f, subquery, QWhere::GreaterEqual);
+}
+
 QWhere QF::operator!() const
 {
     return QFWhere(d->f, QWhere::Null);
@@ -133,6 +164,26 @@ QWhere QF::in(const QVariantList& other) const
     return QFInWhere(d->f, other);
 }
 
+QWhere QF::in(QQuerySet &subquery) const
+{
+    return QFSubqueryWhere(d->f, subquery, QWhere::In);
+}
+
+QWhere QF::notIn(QQuerySet &subquery) const
+{
+    return QFSubqueryWhere(d->f, subquery, QWhere::NotIn);
+}
+
+QWhere QF::exists(const QField &foreignKey, const QWhere &cond) const
+{
+    return QFExistsWhere(d->f, foreignKey, cond, QWhere::Exists);
+}
+
+QWhere QF::notExists(const QField &foreignKey, const QWhere &cond) const
+{
+    return QFExistsWhere(d->f, foreignKey, cond, QWhere::NotExists);
+}
+
 QWhere QF::like(const QString& pattern) const
 {
     return QFLikeWhere(d->f, pattern);
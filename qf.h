@@ -49,9 +49,20 @@ class QF
         QWhere operator<=(const QField &other) const;
         QWhere operator>=(const QField &other) const;
 
+        QWhere operator==(QQuerySet &subquery) const;
+        QWhere operator!=(QQuerySet &subquery) const;
+        QWhere operator<(QQuerySet &subquery) const;
+        QWhere operator>(QQuerySet &subquery) const;
+        QWhere operator<=(QQuerySet &subquery) const;
+        QWhere operator>=(QQuerySet &subquery) const;
+
         QWhere operator!() const;
 
         QWhere in(const QVariantList &other) const;
+        QWhere in(QQuerySet &subquery) const;
+        QWhere notIn(QQuerySet &subquery) const;
+        QWhere exists(const QField &foreignKey, const QWhere &cond = QWhere()) const;
+        QWhere notExists(const QField &foreignKey, const QWhere &cond = QWhere()) const;
         QWhere like(const QString &pattern) const;
         QWhere divisibleBy(int divisor, int offset) const;
         QWhere flagSet(int flag) const;
@@ -23,6 +23,7 @@
 #include "qfield.h"
 #include "qfield_p.h"
 #include "qmodel.h"
+#include "qtormfootprint_p.h"
 
 #include <assert.h>
 
@@ -146,16 +147,19 @@ QString QFieldPrivate::commonSqlDescription() const
     return rs;
 }
 
+qint64 QFieldPrivate::commonHeapSize() const
+{
+    return qtormHeapSize(_name) + _assignation.heapSize();
+}
+
 void QFieldPrivate::ref()
 {
-    _refcount++;
+    _refcount.ref();
 }
 
 bool QFieldPrivate::deref()
 {
-    _refcount--;
-
-    return (_refcount != 0);
+    return _refcount.deref();
 }
 
 /*
@@ -186,16 +190,33 @@ QField::~QField()
 
 QField &QField::operator=(const QField &other)
 {
+    // Reference the new value first, so that self-assignment is safe
+    if (other.d)
+        other.d->ref();
+
     if (d && !d->deref())
         delete d;
 
     d = other.d;
 
-    if (d)
-        d->ref();
+    return *this;
+}
+
+#if defined(__GXX_EXPERIMENTAL_CXX0X__)
+QField &QField::operator=(QField &&other)
+{
+    if (this != &other)
+    {
+        if (d && !d->deref())
+            delete d;
+
+        d = other.d;
+        other.d = nullptr;
+    }
 
     return *this;
 }
+#endif
 
 bool QField::isValid() const
 {
@@ -44,6 +44,7 @@ class QField
     friend class QAssignPrivate;
     friend class QQuerySetPrivate;
     friend class QForeignKeyPrivate;
+    friend class QManyToManyPrivate;
 
     public:
         QField();
@@ -59,15 +60,7 @@ class QField
             d = other.d; other.d = nullptr;
         }
 
-        inline QField &operator=(QField &&other)
-        {
-            if (this != &other)
-            {
-                d = other.d;
-                other.d = nullptr;
-            }
-            return *this;
-        }
+        QField &operator=(QField &&other);
 #endif
 
         QString name() const;
@@ -25,6 +25,7 @@
 
 #include <QString>
 #include <QVariant>
+#include <QAtomicInt>
 
 #include "qassign.h"
 
@@ -52,6 +53,7 @@ class QFieldPrivate
         virtual void fromData(const QVariant &data) = 0;
         virtual QVariant data() const = 0;
         virtual QString sqlDescription() const = 0;
+        virtual qint64 heapSize() const = 0;
 
         virtual bool isForeignKey() const;
 
@@ -60,11 +62,12 @@ class QFieldPrivate
 
     protected:
         QString commonSqlDescription() const;
+        qint64 commonHeapSize() const;
 
     protected:
         QModel *_model;
         QString _name;
-        unsigned int _refcount;
+        QAtomicInt _refcount;
         bool _isnull, _accepts_null, _auto_increment, _primary_key, _modified;
         QAssign _assignation;
 };
@@ -24,6 +24,10 @@
 #include "qforeignkey_p.h"
 #include "qmodel.h"
 #include "qqueryset.h"
+#include "qqueryset_p.h"
+#include "qtormdiagnostics.h"
+#include "qtormtracer_p.h"
+#include "qtormfootprint_p.h"
 
 #include <QtDebug>
 
@@ -66,11 +70,27 @@ void QForeignKeyPrivate::fillCache() const
     if (_id.isNull())
         return;
 
+    QtOrmSpan span(QtOrmTracer::ForeignKeySpan);
+
+    // Count the queries run while iterating over another queryset
+    QQuerySetPrivate *iteration = QQuerySetPrivate::currentIteration();
+
+    if (iteration && QtOrmDiagnostics::nPlusOneThreshold() >= 0)
+        iteration->foreignKeyQuery(this);
+
     // Fill the value model with data from the database
-    QQuerySet query(_value);
+    {
+        QQuerySet query(_value);
+
+        query.addFilter(QF(_value->pk()) == _id);
+        query.next();
 
-    query.addFilter(QF(_value->pk()) == _id);
-    query.next();
+        if (span.isActive())
+            span.setSql(query.sql());
+    }
+
+    // The query above is an iteration of its own
+    QQuerySetPrivate::setCurrentIteration(iteration);
 
     _value->resetModified();
 }
@@ -119,3 +139,10 @@ QString QForeignKeyPrivate::sqlDescription() const
 
     return rs;
 }
+
+qint64 QForeignKeyPrivate::heapSize() const
+{
+    // The model pointed to is not part of the field, QModel::footprint()
+    // reports it separately
+    return sizeof(*this) + commonHeapSize() + qtormHeapSize(_id);
+}
@@ -42,6 +42,7 @@ class QForeignKeyPrivate : public QFieldPrivate
         void fromData(const QVariant &data);
         QVariant data() const;
         QString sqlDescription() const;
+        qint64 heapSize() const;
 
         bool isForeignKey() const;
         void foreignInit();
@@ -22,6 +22,7 @@
 
 #include "qintfield.h"
 #include "qfield_p.h"
+#include "qtormfootprint_p.h"
 
 class QIntFieldPrivate : public QFieldPrivate
 {
@@ -34,6 +35,7 @@ class QIntFieldPrivate : public QFieldPrivate
         void fromData(const QVariant &data);
         QVariant data() const;
         QString sqlDescription() const;
+        qint64 heapSize() const;
 
     private:
         int _value;
@@ -81,6 +83,11 @@ QString QIntFieldPrivate::sqlDescription() const
     return rs;
 }
 
+qint64 QIntFieldPrivate::heapSize() const
+{
+    return sizeof(*this) + commonHeapSize();
+}
+
 /*
  * QIntField
  */
@@ -22,9 +22,17 @@
 
 #include "qmodel.h"
 #include "qfield_p.h"
+#include "qforeignkey_p.h"
+#include "qqueryset.h"
 #include "qtormdatabase.h"
+#include "qtormstats.h"
+#include "qtormslowlog.h"
+#include "qtormalloc_p.h"
+#include "qtormtracer_p.h"
+#include "qtormfootprint_p.h"
 
 #include <QVector>
+#include <QElapsedTimer>
 #include <QList>
 #include <QVariant>
 #include <QtSql>
@@ -46,6 +54,39 @@ struct QModel::Private
     QList<QVariantList> batch;
 };
 
+// Prepare (or take from the cache) and run a statement, recording its statistics and logging it if slow
+static QSqlQuery execStatement(const QSqlDatabase &db, const QString &sql, const QVariantList &values, bool *prepared, bool *ok)
+{
+    QtOrmStatementSample sample;
+    QElapsedTimer timer;
+
+    if (QtOrmStats::isTimed())
+        timer.start();
+
+    QSqlQuery query = QtOrmDatabase::takePreparedQuery(db, sql, prepared);
+
+    if (timer.isValid())
+    {
+        sample.prepareNsecs = timer.nsecsElapsed();
+        timer.restart();
+    }
+
+    *ok = QtOrmDatabase::execQuery(query, db, values);
+
+    if (timer.isValid())
+    {
+        sample.execNsecs = timer.nsecsElapsed();
+        sample.rowsAffected = query.numRowsAffected();
+
+        if (QtOrmStats::isEnabled())
+            QtOrmStats::record(QtOrmStats::normalize(sql), sample);
+
+        QtOrmSlowLog::log(query.lastQuery(), values, sample);
+    }
+
+    return query;
+}
+
 QModel::QModel(const QString &tableName)
 : d(new QModel::Private())
 {
@@ -145,6 +186,8 @@ void QModel::clearBatch()
 
 void QModel::addInBatch()
 {
+    QTORM_ALLOC_SCOPE(BindOperation);
+
     QVariantList row;
 
     // Snapshot the current values and put them into a new batch row
@@ -155,22 +198,18 @@ void QModel::addInBatch()
     d->batch.append(row);
 }
 
-void QModel::saveBatch()
+QString QModel::insertSql(QSqlDriver *driver, int rows, bool skipPrimaryKey) const
 {
-    if (d->batch.size() == 0)
-        return;
+    QTORM_ALLOC_SCOPE(BuildOperation);
 
-    QSqlDriver *driver = QtOrmDatabase::threadDatabase().driver();
-    QSqlQuery query(QtOrmDatabase::threadDatabase());
-
-    // Build the fields list and placeholder lists, skip the primary key
+    // Build the fields list and placeholder lists, skip the primary key if needed
     QString field_list;
     QString placeholders;
     bool first = true;
 
     for (int i=0; i<d->fields.size(); ++i)
     {
-        if (d->fields.at(i).primaryKey() && d->fields.at(i).isNull())
+        if (skipPrimaryKey && d->fields.at(i).primaryKey())
             continue;
 
         if (!first)
@@ -186,40 +225,106 @@ void QModel::saveBatch()
 
     // Multiply placeholders (change "?, ?" to "(?, ?), (?, ?), etc")
     placeholders = QString("(%1), ").arg(placeholders);
-    placeholders = placeholders.repeated(d->batch.size());
+    placeholders = placeholders.repeated(rows);
     placeholders.resize(placeholders.size() - 2);   // Remove the last ", "
 
     // INSERT query
-    QString sql = QString("INSERT INTO %1 (%2) VALUES %3;")
+    return QString("INSERT INTO %1 (%2) VALUES %3;")
         .arg(driver->escapeIdentifier(d->db_table, QSqlDriver::TableName))
         .arg(field_list)
         .arg(placeholders);
+}
 
-    query.prepare(sql);
+QString QModel::updateSql(QSqlDriver *driver, bool modifiedOnly) const
+{
+    QTORM_ALLOC_SCOPE(BuildOperation);
+
+    QString values;
+    bool first = true;
+
+    for (int i=0; i<d->fields.size(); ++i)
+    {
+        // Ne pas mettre à jour les champs non modifiés
+        if (modifiedOnly ? !d->fields.at(i).isModified() : d->fields.at(i).primaryKey())
+            continue;
+
+        if (!first)
+            values += QLatin1String(", ");
+
+        values += driver->escapeIdentifier(d->fields.at(i).name(), QSqlDriver::FieldName);
+        values += QLatin1String("=?");
+        first = false;
+    }
+
+    // UPDATE query
+    return QString("UPDATE %1 SET %2 WHERE %3=?;")
+        .arg(driver->escapeIdentifier(d->db_table, QSqlDriver::TableName))
+        .arg(values)
+        .arg(driver->escapeIdentifier(pk().name(), QSqlDriver::FieldName));
+}
+
+QString QModel::removeSql(QSqlDriver *driver) const
+{
+    QTORM_ALLOC_SCOPE(BuildOperation);
+
+    return QString("DELETE FROM %1 WHERE %2=?;")
+        .arg(driver->escapeIdentifier(d->db_table, QSqlDriver::TableName))
+        .arg(driver->escapeIdentifier(pk().name(), QSqlDriver::FieldName));
+}
+
+bool QModel::saveBatch()
+{
+    if (d->batch.size() == 0)
+        return true;
+
+    QTORM_ALLOC_SCOPE(SaveOperation);
+    QtOrmSpan span(QtOrmTracer::SaveBatchSpan);
+
+    QSqlDatabase db = QtOrmDatabase::threadDatabase();
+    bool skip_pk = pk().isNull();
+    bool prepared, ok;
 
     // Bind the values
-    for (int i=0; i<d->batch.size(); ++i)
+    QVariantList values;
+
     {
-        int field_index_in_batch = 0;
+        QTORM_ALLOC_SCOPE(BindOperation);
+
+        for (int i=0; i<d->batch.size(); ++i)
+        {
+            int field_index_in_batch = 0;
 
-        for (int j=0; j<d->fields.size(); ++j)
-            if (!(d->fields.at(j).primaryKey() && d->fields.at(j).isNull()))
-                query.addBindValue(d->batch.at(i).at(field_index_in_batch++));
+            for (int j=0; j<d->fields.size(); ++j)
+                if (!(skip_pk && d->fields.at(j).primaryKey()))
+                    values.append(d->batch.at(i).at(field_index_in_batch++));
+        }
     }
 
-    if (!query.exec())
+    // INSERT query, the statement is reused for batches of the same size
+    QString sql = insertSql(db.driver(), d->batch.size(), skip_pk);
+    QSqlQuery query = execStatement(db, sql, values, &prepared, &ok);
+
+    span.setSql(sql);
+    span.setRows(query.numRowsAffected());
+
+    if (!ok)
     {
         qDebug() << "Could not save object :" << query.lastError();
     }
 
     // Set the id
     pk().setRawData(query.lastInsertId());
+
+    if (prepared)
+        QtOrmDatabase::recycleQuery(query);
+
+    return ok;
 }
 
 void QModel::save(bool forceInsert)
 {
-    QSqlDriver *driver = QtOrmDatabase::threadDatabase().driver();
-    QSqlQuery query(QtOrmDatabase::threadDatabase());
+    QTORM_ALLOC_SCOPE(SaveOperation);
+    QtOrmSpan span(QtOrmTracer::SaveSpan);
 
     if (forceInsert || pk().isNull())
     {
@@ -231,65 +336,62 @@ void QModel::save(bool forceInsert)
     else
     {
         // Only update an existing field
-        QString values;
-        bool first = true;
+        QSqlDatabase db = QtOrmDatabase::threadDatabase();
+        QVariantList values;
+        bool prepared, ok;
 
-        for (int i=0; i<d->fields.size(); ++i)
         {
-            // Ne pas mettre à jour les champs non modifiés
-            if (!d->fields.at(i).isModified())
-                continue;
+            QTORM_ALLOC_SCOPE(BindOperation);
 
-            if (!first)
-                values += QLatin1String(", ");
+            for (int i=0; i<d->fields.size(); ++i)
+            {
+                if (d->fields.at(i).isModified())
+                    values.append(d->fields.at(i).data());
+            }
 
-            values += driver->escapeIdentifier(d->fields.at(i).name(), QSqlDriver::FieldName);
-            values += QLatin1String("=?");
-            first = false;
+            values.append(pk().data());
         }
 
-        // UPDATE query
-        QString sql = QString("UPDATE %1 SET %2 WHERE %3=?;")
-            .arg(driver->escapeIdentifier(d->db_table, QSqlDriver::TableName))
-            .arg(values)
-            .arg(driver->escapeIdentifier(pk().name(), QSqlDriver::FieldName));
+        QString sql = updateSql(db.driver(), true);
+        QSqlQuery query = execStatement(db, sql, values, &prepared, &ok);
 
-        query.prepare(sql);
+        span.setSql(sql);
+        span.setRows(query.numRowsAffected());
 
-        for (int i=0; i<d->fields.size(); ++i)
-        {
-            if (d->fields.at(i).isModified())
-                query.addBindValue(d->fields.at(i).data());
-        }
-
-        query.addBindValue(pk().data());
-
-        if (!query.exec())
+        if (!ok)
         {
             qDebug() << "Could not update object :" << query.lastError();
         }
+
+        if (prepared)
+            QtOrmDatabase::recycleQuery(query);
     }
 }
 
 void QModel::remove()
 {
-    QSqlDriver *driver = QtOrmDatabase::threadDatabase().driver();
-    QSqlQuery query(QtOrmDatabase::threadDatabase());
+    QTORM_ALLOC_SCOPE(SaveOperation);
+    QtOrmSpan span(QtOrmTracer::RemoveSpan);
+
+    QSqlDatabase db = QtOrmDatabase::threadDatabase();
+    QString sql = removeSql(db.driver());
+    bool prepared, ok;
 
     // DELETE the current object, and set pk() to NULL
-    QString sql = QString("DELETE FROM %1 WHERE %2=?;")
-        .arg(driver->escapeIdentifier(d->db_table, QSqlDriver::TableName))
-        .arg(driver->escapeIdentifier(pk().name(), QSqlDriver::FieldName));
+    QSqlQuery query = execStatement(db, sql, QVariantList() << pk().data(), &prepared, &ok);
 
-    query.prepare(sql);
-    query.addBindValue(pk().data());
+    span.setSql(sql);
+    span.setRows(query.numRowsAffected());
 
-    if (!query.exec())
+    if (!ok)
     {
         qDebug() << "Could not delete object :" << query.lastError();
     }
 
     pk().setNull(true);
+
+    if (prepared)
+        QtOrmDatabase::recycleQuery(query);
 }
 
 QString QModel::createTableSql() const
@@ -354,3 +456,107 @@ const QField &QModel::field(int i) const
 {
     return d->fields.at(i);
 }
+
+/*
+ * Footprint
+ */
+
+QModel::Footprint::Footprint()
+ : privateBytes(0), foreignModelBytes(0), batchBytes(0), querySetBytes(0)
+{
+}
+
+qint64 QModel::Footprint::fieldBytes() const
+{
+    qint64 rs = 0;
+
+    for (int i=0; i<fields.count(); ++i)
+        rs += fields.at(i).second;
+
+    return rs;
+}
+
+qint64 QModel::Footprint::total() const
+{
+    return privateBytes + fieldBytes() + foreignModelBytes + batchBytes + querySetBytes;
+}
+
+QString QModel::Footprint::toString() const
+{
+    QString rs;
+
+    rs += QLatin1String("private: ") + QString::number(privateBytes) + QLatin1Char('\n');
+
+    for (int i=0; i<fields.count(); ++i)
+        rs += QLatin1String("field ") + fields.at(i).first + QLatin1String(": ")
+            + QString::number(fields.at(i).second) + QLatin1Char('\n');
+
+    rs += QLatin1String("foreign models: ") + QString::number(foreignModelBytes) + QLatin1Char('\n');
+    rs += QLatin1String("batch: ") + QString::number(batchBytes) + QLatin1Char('\n');
+    rs += QLatin1String("queryset: ") + QString::number(querySetBytes) + QLatin1Char('\n');
+    rs += QLatin1String("total: ") + QString::number(total()) + QLatin1Char('\n');
+
+    return rs;
+}
+
+QModel::Footprint QModel::footprint(const QQuerySet *querySet) const
+{
+    Footprint rs;
+    QSet<const QModel *> visited;
+
+    rs.privateBytes = sizeof(Private) + qtormHeapSize(d->db_table) + qtormVectorHeapSize(d->fields);
+    rs.batchBytes = qtormHeapSize(d->batch);
+
+    for (int i=0; i<d->fields.count(); ++i)
+    {
+        const QField &f = d->fields.at(i);
+
+        rs.fields.append(qMakePair(f.name(), f.d->heapSize()));
+    }
+
+    visited.insert(this);
+    rs.foreignModelBytes = foreignModelsHeapSize(visited);
+
+    if (querySet)
+        rs.querySetBytes = querySet->heapSize();
+
+    return rs;
+}
+
+qint64 QModel::heapSize(QSet<const QModel *> &visited) const
+{
+    // The subclass is not known, assume it only holds its fields
+    qint64 rs = sizeof(QModel) + d->fields.count() * sizeof(QField);
+
+    rs += sizeof(Private) + qtormHeapSize(d->db_table) + qtormVectorHeapSize(d->fields);
+    rs += qtormHeapSize(d->batch);
+
+    for (int i=0; i<d->fields.count(); ++i)
+        rs += d->fields.at(i).d->heapSize();
+
+    return rs + foreignModelsHeapSize(visited);
+}
+
+qint64 QModel::foreignModelsHeapSize(QSet<const QModel *> &visited) const
+{
+    qint64 rs = 0;
+
+    for (int i=0; i<d->fields.count(); ++i)
+    {
+        QFieldPrivate *field = d->fields.at(i).d;
+
+        if (!field->isForeignKey())
+            continue;
+
+        // Models can reference themselves, or be shared by several keys
+        QModel *model = static_cast<QForeignKeyPrivate *>(field)->value();
+
+        if (!model || visited.contains(model))
+            continue;
+
+        visited.insert(model);
+        rs += model->heapSize(visited);
+    }
+
+    return rs;
+}
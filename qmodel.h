@@ -25,20 +25,28 @@
 
 #include <QSqlDatabase>
 #include <QString>
+#include <QList>
+#include <QPair>
+#include <QSet>
 
 #include "qstringfield.h"
 #include "qintfield.h"
 #include "qforeignkey.h"
 #include "qdoublefield.h"
 #include "qdatetimefield.h"
+#include "qreverserelation.h"
 
+class QQuerySet;
 class QQuerySetPrivate;
 class QForeignKeyPrivate;
+class QSqlDriver;
 
 class QModel
 {
     friend class QQuerySetPrivate;
     friend class QField;
+    friend class QtOrmDatabase;
+    friend class QReverseRelationPrivate;
 
     private:
         Q_DISABLE_COPY(QModel)
@@ -52,7 +60,7 @@ class QModel
 
         void clearBatch();
         void addInBatch();
-        void saveBatch();
+        bool saveBatch();
 
         void setTableName(const QString &tableName);
         void save(bool forceInsert=false);
@@ -60,6 +68,30 @@ class QModel
         void resetModified();
         QString createTableSql() const;
 
+        /**
+         * @brief Approximate heap usage of a model instance
+         *
+         * Sizes follow the Qt 4 data layouts and are estimates, meant to
+         * compare models and layouts rather than to account for every byte.
+         * Implicitly shared data is counted for each holder.
+         */
+        struct Footprint
+        {
+            Footprint();
+
+            qint64 privateBytes;        /*!< @brief QModel::Private, with the table name and the field list */
+            QList<QPair<QString, qint64> > fields;  /*!< @brief Bytes held by each QFieldPrivate : name, assignation and value */
+            qint64 foreignModelBytes;   /*!< @brief Models instantiated by the foreign keys, recursively and once each */
+            qint64 batchBytes;          /*!< @brief Rows buffered by addInBatch() */
+            qint64 querySetBytes;       /*!< @brief The queryset passed to footprint(), 0 if none */
+
+            qint64 fieldBytes() const;
+            qint64 total() const;
+            QString toString() const;
+        };
+
+        Footprint footprint(const QQuerySet *querySet = 0) const;
+
     protected:
         void init();
 
@@ -69,6 +101,10 @@ class QModel
         QDateTimeField dateTimeField(const QString &name);
         template<typename T>
         QForeignKey<T> foreignKey(const QString &name);
+        template<typename T>
+        QReverseRelation<T> reverseRelation(const QString &foreignKey);    /*!< @brief Models T whose foreign key named foreignKey points to this one */
+        template<typename T, typename Through>
+        QManyToMany<T> manyToMany(const QString &sourceKey, const QString &targetKey);    /*!< @brief Models T linked to this one by the foreign keys sourceKey and targetKey of Through */
 
     private:
         void getForeignKeys(QVector<QForeignKeyPrivate *> &foreignKeys) const;
@@ -78,6 +114,13 @@ class QModel
         int fieldsCount() const;
         const QField &field(int i) const;
 
+        QString insertSql(QSqlDriver *driver, int rows, bool skipPrimaryKey) const;
+        QString updateSql(QSqlDriver *driver, bool modifiedOnly) const;
+        QString removeSql(QSqlDriver *driver) const;
+
+        qint64 heapSize(QSet<const QModel *> &visited) const;
+        qint64 foreignModelsHeapSize(QSet<const QModel *> &visited) const;
+
     private:
         struct Private;
         Private *d;
@@ -95,4 +138,16 @@ QForeignKey<T> QModel::foreignKey(const QString &name)
     return rs;
 }
 
+template<typename T>
+QReverseRelation<T> QModel::reverseRelation(const QString &foreignKey)
+{
+    return QReverseRelation<T>(this, foreignKey);
+}
+
+template<typename T, typename Through>
+QManyToMany<T> QModel::manyToMany(const QString &sourceKey, const QString &targetKey)
+{
+    return QManyToMany<T>(new QManyToManyPrivateT<T, Through>(this, sourceKey, targetKey));
+}
+
 #endif
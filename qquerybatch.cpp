@@ -0,0 +1,226 @@
+/*
+ * qquerybatch.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "qquerybatch.h"
+#include "qqueryset.h"
+#include "qqueryset_p.h"
+#include "qtormtracer_p.h"
+
+#include <QtSql>
+#include <QtDebug>
+#include <QElapsedTimer>
+
+struct QQueryBatch::Private
+{
+    Private()
+     : round_trips(0),
+       elapsed(0)
+    {
+    }
+
+    int execCombined();
+
+    QList<QQuerySet *> querysets;
+
+    int round_trips;
+    qint64 elapsed;
+};
+
+int QQueryBatch::Private::execCombined()
+{
+    QSqlDatabase db = querysets.at(0)->d->database();
+    QString sql;
+    QList<QVariantList> values;
+
+    // Build every statement, and put them in the same query
+    for (int i=0; i<querysets.count(); ++i)
+    {
+        QQuerySetPrivate *qs = querysets.at(i)->d;
+        QString inlined;
+
+        values.append(QVariantList());
+        qs->buildStatement(false);
+
+        bool set_up = qs->setUpFilters(db);
+
+        if (set_up)
+        {
+            qs->bindValues(values[i]);
+
+            // Multi-statement queries cannot be prepared
+            inlined = QQuerySetPrivate::inlineValues(qs->sql(), values.at(i), db.driver());
+        }
+
+        if (inlined.isNull())
+        {
+            // The querysets are run one after the other instead
+            for (int j=0; j<i; ++j)
+                querysets.at(j)->d->tearDownFilters(db);
+
+            if (set_up)
+                qs->tearDownFilters(db);
+
+            return 0;
+        }
+
+        sql += inlined;
+        sql += QLatin1String(";\n");
+    }
+
+    QSqlQuery query(db);
+    QElapsedTimer timer;
+    int done = querysets.count();
+
+    query.setForwardOnly(true);
+
+    {
+        QtOrmSpan span(QtOrmTracer::ExecSpan);
+
+        span.setSql(sql);
+        timer.start();
+
+        if (!query.exec(sql))
+        {
+            qDebug() << "Cannot execute the batched query \"" << query.lastQuery() << "\" :" << query.lastError();
+            done = 0;
+        }
+        else
+        {
+            round_trips++;
+        }
+    }
+
+    // The round trip is shared by the statements in the statistics
+    qint64 exec_nsecs = timer.nsecsElapsed() / querysets.count();
+
+    // Give each result set to its queryset
+    for (int i=0; i<done; ++i)
+    {
+        QQuerySetPrivate *qs = querysets.at(i)->d;
+        QList<QVariantList> rows;
+        int columns = qs->columnCount();
+
+        if (i != 0 && !query.nextResult())
+        {
+            done = i;
+            break;
+        }
+
+        while (query.next())
+        {
+            QVariantList row;
+
+            for (int j=0; j<columns; ++j)
+                row.append(query.value(j));
+
+            rows.append(row);
+        }
+
+        qs->setBufferedRows(rows, values.at(i), exec_nsecs);
+    }
+
+    // The rows are buffered, the temporary tables of the filters can go
+    query.finish();
+
+    for (int i=0; i<querysets.count(); ++i)
+        querysets.at(i)->d->tearDownFilters(db);
+
+    return done;
+}
+
+/*
+ * QQueryBatch
+ */
+
+QQueryBatch::QQueryBatch()
+: d(new Private)
+{
+}
+
+QQueryBatch::~QQueryBatch()
+{
+    delete d;
+}
+
+void QQueryBatch::addQuerySet(QQuerySet *querySet)
+{
+    d->querysets.append(querySet);
+}
+
+void QQueryBatch::clear()
+{
+    d->querysets.clear();
+    d->round_trips = 0;
+    d->elapsed = 0;
+}
+
+bool QQueryBatch::exec()
+{
+    QElapsedTimer timer;
+    bool rs = true;
+    int done = 0;
+
+    timer.start();
+    d->round_trips = 0;
+
+    if (d->querysets.isEmpty())
+        return true;
+
+    QSqlDatabase db = d->querysets.at(0)->d->database();
+
+    if (d->querysets.count() > 1 && db.driver()->hasFeature(QSqlDriver::MultipleResultSets))
+    {
+        done = d->execCombined();
+    }
+
+    // Sequential fallback, for the querysets the combined query did not run
+    for (int i=done; i<d->querysets.count(); ++i)
+    {
+        QQuerySetPrivate *qs = d->querysets.at(i)->d;
+
+        qs->build(false);
+
+        if (!qs->exec())
+            rs = false;
+
+        d->round_trips++;
+    }
+
+    d->elapsed = timer.nsecsElapsed();
+
+    return rs;
+}
+
+int QQueryBatch::roundTrips() const
+{
+    return d->round_trips;
+}
+
+int QQueryBatch::roundTripsSaved() const
+{
+    return d->querysets.count() - d->round_trips;
+}
+
+qint64 QQueryBatch::nsecsElapsed() const
+{
+    return d->elapsed;
+}
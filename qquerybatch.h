@@ -0,0 +1,65 @@
+/*
+ * qquerybatch.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QQUERYBATCH_H__
+#define __QQUERYBATCH_H__
+
+#include <QtGlobal>
+
+class QQuerySet;
+
+/**
+ * @brief Runs several independent querysets in as few round trips as possible
+ *
+ * When the database driver supports multiple result sets, the SELECT statements
+ * of every queryset are sent as a single multi-statement query, and each
+ * queryset receives its own rows. The querysets can then be iterated with
+ * QQuerySet::next() as usual, without touching the database again.
+ *
+ * Other drivers (SQLite, PostgreSQL) run the querysets one after the other.
+ * roundTrips() and roundTripsSaved() tell what happened during the last exec().
+ */
+class QQueryBatch
+{
+    private:
+        Q_DISABLE_COPY(QQueryBatch)
+
+    public:
+        QQueryBatch();
+        ~QQueryBatch();
+
+        void addQuerySet(QQuerySet *querySet);    /*!< @brief The queryset is not owned by the batch and must stay alive until it is iterated */
+        void clear();
+
+        bool exec();
+
+        // Instrumentation of the last exec()
+        int roundTrips() const;
+        int roundTripsSaved() const;
+        qint64 nsecsElapsed() const;
+
+    private:
+        struct Private;
+        Private *d;
+};
+
+#endif
@@ -0,0 +1,339 @@
+/*
+ * qqueryplan.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "qqueryplan.h"
+#include "qqueryset_p.h"
+#include "qmodel.h"
+
+#include <QtSql>
+#include <QtDebug>
+#include <QRegExp>
+#include <QHash>
+#include <QSet>
+
+// Development mode, disabled when negative
+static int large_table_rows = -1;
+
+// Statements already checked, and sizes of the tables, per thread
+static __thread QSet<QString> *checked_statements = NULL;
+static __thread QHash<QString, qint64> *table_sizes = NULL;
+
+/*
+ * QQueryPlan
+ */
+
+bool QQueryPlan::isValid() const
+{
+    return steps.count() != 0;
+}
+
+QStringList QQueryPlan::fullScans() const
+{
+    QStringList rs;
+
+    for (int i=0; i<steps.count(); ++i)
+    {
+        const Step &step = steps.at(i);
+
+        if (step.fullScan && !step.table.isEmpty() && !rs.contains(step.table))
+            rs.append(step.table);
+    }
+
+    return rs;
+}
+
+QString QQueryPlan::toString() const
+{
+    QHash<int, int> depths;
+    QString rs;
+
+    for (int i=0; i<steps.count(); ++i)
+    {
+        const Step &step = steps.at(i);
+        int depth = (step.parent == -1 ? 0 : depths.value(step.parent, 0) + 1);
+
+        depths.insert(step.id, depth);
+
+        rs += QString(depth * 2, QLatin1Char(' '));
+        rs += step.detail;
+        rs += QLatin1Char('\n');
+    }
+
+    return rs;
+}
+
+/*
+ * Parsing of the output of EXPLAIN
+ */
+
+static QString resolveTable(const QString &name, const QStringList &tables)
+{
+    // QtORM aliases, lowercased by PostgreSQL
+    QRegExp alias("^T(\\d+)$", Qt::CaseInsensitive);
+
+    if (alias.exactMatch(name))
+    {
+        int number = alias.cap(1).toInt();
+
+        if (number < tables.count())
+            return tables.at(number);
+    }
+
+    return name;
+}
+
+static QQueryPlan::Step newStep(int id, int parent, const QString &detail)
+{
+    QQueryPlan::Step step;
+
+    step.id = id;
+    step.parent = parent;
+    step.detail = detail;
+    step.fullScan = false;
+    step.estimatedRows = -1;
+
+    return step;
+}
+
+static void parseSqlitePlan(QSqlQuery &query, const QStringList &tables, QQueryPlan &plan)
+{
+    // id, parent, notused, detail. "SCAN T0", or "SCAN TABLE pupils AS T0" before SQLite 3.36
+    QRegExp scan("^(SCAN|SEARCH) (TABLE )?(\\S+)( AS (\\S+))?");
+
+    while (query.next())
+    {
+        QQueryPlan::Step step = newStep(query.value(0).toInt(), query.value(1).toInt(), query.value(3).toString());
+
+        if (step.parent == 0)
+            step.parent = -1;
+
+        if (scan.indexIn(step.detail) == 0 &&
+            scan.cap(3) != QLatin1String("CONSTANT") &&
+            scan.cap(3) != QLatin1String("SUBQUERY"))
+        {
+            step.table = resolveTable(scan.cap(5).isEmpty() ? scan.cap(3) : scan.cap(5), tables);
+            step.fullScan = (scan.cap(1) == QLatin1String("SCAN") && !step.detail.contains(QLatin1String("INDEX")));
+        }
+
+        plan.steps.append(step);
+    }
+}
+
+static void parseMysqlPlan(QSqlQuery &query, const QStringList &tables, QQueryPlan &plan)
+{
+    // One row per table, the columns depend on the version of MySQL
+    QSqlRecord record = query.record();
+    int table_col = record.indexOf(QLatin1String("table"));
+    int type_col = record.indexOf(QLatin1String("type"));
+    int key_col = record.indexOf(QLatin1String("key"));
+    int rows_col = record.indexOf(QLatin1String("rows"));
+    int extra_col = record.indexOf(QLatin1String("Extra"));
+    int id = 0;
+
+    while (query.next())
+    {
+        QString table = resolveTable(query.value(table_col).toString(), tables);
+        QString type = query.value(type_col).toString();
+        QString detail = QString("%1 on %2").arg(type).arg(table);
+
+        if (key_col != -1 && !query.value(key_col).isNull())
+            detail += QString(" using %1").arg(query.value(key_col).toString());
+
+        if (extra_col != -1 && !query.value(extra_col).toString().isEmpty())
+            detail += QString(" (%1)").arg(query.value(extra_col).toString());
+
+        QQueryPlan::Step step = newStep(id++, -1, detail);
+
+        step.table = table;
+        step.fullScan = (type == QLatin1String("ALL"));
+
+        if (rows_col != -1 && !query.value(rows_col).isNull())
+            step.estimatedRows = query.value(rows_col).toLongLong();
+
+        plan.steps.append(step);
+    }
+}
+
+static void parsePostgresPlan(QSqlQuery &query, const QStringList &tables, QQueryPlan &plan)
+{
+    // One line per node, indented under its parent:
+    // "  ->  Seq Scan on pupils t0  (cost=0.00..35.50 rows=2550 width=4)"
+    QRegExp scan("(Seq|Index|Index Only|Bitmap Heap) Scan (using \\S+ )?on (\\S+)( (\\S+))?");
+    QRegExp rows("rows=(\\d+)");
+    QList<QPair<int, int> > parents;     // (indentation, id)
+    int id = 0;
+
+    while (query.next())
+    {
+        QString line = query.value(0).toString();
+        QString detail = line.trimmed();
+        int indent = line.size() - line.trimmed().size();
+
+        if (detail.startsWith(QLatin1String("->")))
+            detail = detail.mid(2).trimmed();
+
+        while (!parents.isEmpty() && parents.last().first >= indent)
+            parents.removeLast();
+
+        QQueryPlan::Step step = newStep(id, parents.isEmpty() ? -1 : parents.last().second, detail);
+
+        if (scan.indexIn(detail) != -1)
+        {
+            QString alias = scan.cap(5);
+
+            step.table = resolveTable(alias.isEmpty() || alias.startsWith(QLatin1Char('(')) ? scan.cap(3) : alias, tables);
+            step.fullScan = (scan.cap(1) == QLatin1String("Seq"));
+        }
+
+        if (rows.indexIn(detail) != -1)
+            step.estimatedRows = rows.cap(1).toLongLong();
+
+        // Filters and other properties of a node are not steps of their own
+        if (detail.contains(QLatin1String("(cost=")))
+        {
+            parents.append(qMakePair(indent, id++));
+            plan.steps.append(step);
+        }
+        else if (!plan.steps.isEmpty())
+        {
+            plan.steps.last().detail += QLatin1String(", ") + detail;
+        }
+    }
+}
+
+static void parseGenericPlan(QSqlQuery &query, QQueryPlan &plan)
+{
+    int columns = query.record().count();
+    int id = 0;
+
+    while (query.next())
+    {
+        QStringList detail;
+
+        for (int i=0; i<columns; ++i)
+            detail.append(query.value(i).toString());
+
+        plan.steps.append(newStep(id++, -1, detail.join(QLatin1String(" | "))));
+    }
+}
+
+/*
+ * QQuerySetPrivate
+ */
+
+QQueryPlan QQuerySetPrivate::explain()
+{
+    QQueryPlan plan;
+    QVariantList values;
+
+    buildStatement(false);
+
+    // The temporary tables of the filters are already there when exec()
+    // checks the plan
+    bool set_up = !_filters_set_up;
+
+    if (set_up && !setUpFilters(_db))
+        return plan;
+
+    bindValues(values);
+
+    // EXPLAIN cannot always be prepared, the values are inlined
+    QString driver = _db.driverName();
+    bool sqlite = driver.startsWith(QLatin1String("QSQLITE"));
+    QSqlQuery query(_db);
+
+    plan.sql = inlineValues(_sql, values, _driver);
+
+    if (plan.sql.isNull())
+    {
+        qDebug() << "Cannot explain the query \"" << _sql << "\" : it contains a literal '?'";
+    }
+    else if (!query.exec(QString(sqlite ? "EXPLAIN QUERY PLAN %1" : "EXPLAIN %1").arg(plan.sql)))
+    {
+        qDebug() << "Cannot explain the query \"" << plan.sql << "\" :" << query.lastError();
+    }
+    else if (sqlite)
+        parseSqlitePlan(query, _tables, plan);
+    else if (driver.startsWith(QLatin1String("QMYSQL")))
+        parseMysqlPlan(query, _tables, plan);
+    else if (driver.startsWith(QLatin1String("QPSQL")))
+        parsePostgresPlan(query, _tables, plan);
+    else
+        parseGenericPlan(query, plan);
+
+    if (set_up)
+    {
+        query.finish();
+        tearDownFilters(_db);
+    }
+
+    return plan;
+}
+
+void QQuerySetPrivate::setDevelopmentMode(bool enable, int largeTableRows)
+{
+    large_table_rows = (enable ? largeTableRows : -1);
+}
+
+void QQuerySetPrivate::checkPlan()
+{
+    if (large_table_rows < 0)
+        return;
+
+    if (!checked_statements)
+    {
+        checked_statements = new QSet<QString>;
+        table_sizes = new QHash<QString, qint64>;
+    }
+
+    // Every statement is only checked once per thread
+    if (checked_statements->contains(_sql))
+        return;
+
+    checked_statements->insert(_sql);
+
+    QStringList scans = explain().fullScans();
+
+    for (int i=0; i<scans.count(); ++i)
+    {
+        const QString &table = scans.at(i);
+
+        if (!table_sizes->contains(table))
+        {
+            QSqlQuery count(_db);
+            qint64 rows = 0;
+
+            if (count.exec(QString("SELECT COUNT(*) FROM %1").arg(_driver->escapeIdentifier(table, QSqlDriver::TableName))) && count.next())
+                rows = count.value(0).toLongLong();
+
+            table_sizes->insert(table, rows);
+        }
+
+        qint64 rows = table_sizes->value(table);
+
+        if (rows >= large_table_rows)
+        {
+            qDebug() << "Full scan of table" << table << "(" << rows << "rows ) in the query \"" << _sql << "\","
+                     << "consider adding an index on the filtered fields";
+        }
+    }
+}
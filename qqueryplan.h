@@ -0,0 +1,57 @@
+/*
+ * qqueryplan.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QQUERYPLAN_H__
+#define __QQUERYPLAN_H__
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+/**
+ * @brief Execution plan of a statement, returned by QQuerySet::explain()
+ *
+ * The plan is read from EXPLAIN QUERY PLAN on SQLite and EXPLAIN on the other
+ * databases. The table aliases used by QtORM (T0, T1, ...) are replaced by
+ * the names of the tables.
+ */
+struct QQueryPlan
+{
+    struct Step
+    {
+        int id;
+        int parent;             /*!< @brief id of the parent step, -1 for a top-level step */
+        QString detail;         /*!< @brief Text of the step, as printed by the database */
+        QString table;          /*!< @brief Table read by this step, empty if none */
+        bool fullScan;          /*!< @brief The step reads the whole table, without an index */
+        qint64 estimatedRows;   /*!< @brief Rows estimated by the database, -1 if unknown */
+    };
+
+    QString sql;                /*!< @brief Statement explained, with its values inlined */
+    QList<Step> steps;
+
+    bool isValid() const;
+    QStringList fullScans() const;  /*!< @brief Tables read entirely by a step of the plan */
+    QString toString() const;
+};
+
+#endif
@@ -21,92 +21,87 @@
  */
 
 #include "qqueryset.h"
+#include "qqueryset_p.h"
+#include "qreverserelation_p.h"
 #include "qmodel.h"
 #include "qfield.h"
 #include "qf.h"
 #include "qtormdatabase.h"
+#include "qtormstats.h"
+#include "qtormslowlog.h"
+#include "qtormdiagnostics.h"
+#include "qforeignkey_p.h"
+#include "qtormalloc_p.h"
+#include "qtormtracer_p.h"
+#include "qtormfootprint_p.h"
 
 #include <QtSql>
 #include <QtDebug>
-#include <QVector>
-#include <QSet>
-#include <QPair>
-#include <QString>
-
-class QForeignKeyPrivate;
-
-class QQuerySetPrivate
-{
-    public:
-        QQuerySetPrivate(QModel *model, const QSqlDatabase &db);
-        ~QQuerySetPrivate();
-
-        void addSelectRelated(const QField &field);
-        void addFilter(const QWhere &cond);
-        void addOrderBy(const QField &field, bool asc);
-        void addField(const QField &field);
-        void addFields(QModel *model);
-        void excludeField(const QField &field);
-        void setLimit(int count);
-        void setOffset(int val);
-
-        bool next();
-        bool update(int *affectedRows);
-
-        void build(bool for_remove);
-        void exec();
-        QString sql() const;
-        void reset();
-
-    private:
-        struct Join
-        {
-            QModel *model;
-            QForeignKeyPrivate *parent_foreignkey;
-            bool accepts_null;
-        };
-
-        bool buildJoins(QList<QQuerySetPrivate::Join> &joins, bool useSelectedFields);
-        QList<Join> buildSelectedFields(bool for_remove);
-        QString buildSelect();
-        QString buildFrom(const QList<Join> &joins, bool for_remove);
-        QString buildWhere(bool for_remove);
-        QString buildOrderBy();
-        QString buildLimit();
-
-    private:
-        QSqlDriver *_driver;
-        QModel *_model;
-        int _limit, _offset;
-        bool _built, _executed;
-
-        QVector<QField> _selected_fields;
-        QSet<QField> _excluded_fields;
-        QSet<QModel *> _selected_models;
-        QVector<QField> _select_related;
-        QVector<QWhere> _filter;
-        QVector<QPair<QField, bool> > _order_by;
-
-        QSqlQuery _query;
-};
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
 
 /*
  * Private
  */
 
-QQuerySetPrivate::QQuerySetPrivate(QModel *model, const QSqlDatabase &db)
-: _driver(db.driver()),
+static __thread QQuerySetPrivate *current_iteration = NULL;
+
+// Table numbers are allocated per statement: the main queryset starts at T0,
+// and its subqueries continue after the tables already numbered
+static __thread int next_table_number = 0;
+
+// Generating a subquery numbers its models, that filters shared between
+// threads have in common. Recursive, for the subqueries of subqueries.
+static QMutex subquery_mutex(QMutex::Recursive);
+
+QQuerySetPrivate::QQuerySetPrivate(QModel *model)
+: _refcount(1),
+  _driver(NULL),
   _model(model),
   _limit(0),
   _offset(0),
+  _first_table(0),
   _built(false),
+  _prepared(false),
   _executed(false),
-  _query(db)
+  _filters_set_up(false),
+  _holds_connection(false),
+  _thread_warned(false),
+  _distinct(false),
+  _lock_mode(QQuerySet::NoLock),
+  _group_limit(0),
+  _sample_pending(false),
+  _fetch_span(NULL),
+  _prefetch_chunk(0),
+  _chunk_row(0),
+  _buffered(false),
+  _buffered_row(0)
 {
 }
 
 QQuerySetPrivate::~QQuerySetPrivate()
 {
+    finishStatement();
+
+    if (current_iteration == this)
+        current_iteration = NULL;
+
+    // Give the prepared statement back, another queryset of the same shape will reuse it
+    if (_prepared)
+        QtOrmDatabase::recycleQuery(_query);
+
+    clearPrefetchRelated();
+}
+
+void QQuerySetPrivate::ref()
+{
+    _refcount.ref();
+}
+
+bool QQuerySetPrivate::deref()
+{
+    return _refcount.deref();
 }
 
 void QQuerySetPrivate::addSelectRelated(const QField &field)
@@ -114,6 +109,27 @@ void QQuerySetPrivate::addSelectRelated(const QField &field)
     _select_related.append(field);
 }
 
+void QQuerySetPrivate::addPrefetchRelated(QReverseRelationPrivate *relation, int chunkSize)
+{
+    relation->ref();
+    _prefetch_related.append(relation);
+
+    if (_prefetch_chunk == 0 || chunkSize < _prefetch_chunk)
+        _prefetch_chunk = qMax(chunkSize, 1);
+}
+
+void QQuerySetPrivate::clearPrefetchRelated()
+{
+    for (int i=0; i<_prefetch_related.count(); ++i)
+    {
+        if (!_prefetch_related.at(i)->deref())
+            delete _prefetch_related.at(i);
+    }
+
+    _prefetch_related.clear();
+    _prefetch_chunk = 0;
+}
+
 void QQuerySetPrivate::addFilter(const QWhere &cond)
 {
     _filter.append(cond);
@@ -155,9 +171,89 @@ void QQuerySetPrivate::setOffset(int val)
     _offset = val;
 }
 
+void QQuerySetPrivate::setDistinct(bool distinct)
+{
+    _distinct = distinct;
+}
+
+void QQuerySetPrivate::addDistinctOn(const QField &field)
+{
+    _distinct_on.append(field);
+}
+
+void QQuerySetPrivate::setLockMode(QQuerySet::LockMode mode)
+{
+    _lock_mode = mode;
+}
+
+void QQuerySetPrivate::setLimitPerGroup(const QField &groupBy, int count)
+{
+    _group_field = groupBy;
+    _group_limit = count;
+}
+
 QString QQuerySetPrivate::sql() const
 {
-    return _query.lastQuery();
+    return _sql;
+}
+
+QSqlDatabase QQuerySetPrivate::database()
+{
+    // The queryset uses the database of the thread that first builds it, so
+    // that it can be created in a thread and run in another (QtOrmExecutor)
+    if (!_driver)
+    {
+        _db = QtOrmDatabase::threadDatabase();
+        _driver = _db.driver();
+    }
+
+    return _db;
+}
+
+void QQuerySetPrivate::checkThreadDatabase()
+{
+    // The threads of a QtOrmExecutor must each use their own connection
+    if (_thread_warned)
+        return;
+
+    if (!QtOrmDatabase::perThreadDatabase())
+    {
+        qWarning() << "QQuerySet::nextAsync() without per-thread databases: the executor threads share"
+                 << "the default connection, call QtOrmDatabase::setPerThreadDatabase(true)";
+        _thread_warned = true;
+    }
+    else if (_driver && _driver != QtOrmDatabase::threadDatabase().driver())
+    {
+        qWarning() << "QQuerySet::nextAsync(): the queryset was built in another thread and uses its"
+                 << "connection, build it in the executor thread instead";
+        _thread_warned = true;
+    }
+}
+
+int QQuerySetPrivate::columnCount() const
+{
+    return _selected_fields.count();
+}
+
+void QQuerySetPrivate::setBufferedRows(const QList<QVariantList> &rows, const QVariantList &values, qint64 execNsecs)
+{
+    // The query has been run by someone else, next() reads these rows
+    _buffered = true;
+    _buffered_row = 0;
+    _buffered_rows = rows;
+    _executed = true;
+    _chunk_row = 0;
+    _chunk_rows.clear();
+
+    // Recorded by finishStatement() like the statements run by exec()
+    if (QtOrmStats::isTimed())
+    {
+        _sample.execNsecs = execNsecs;
+        _sample_pending = true;
+
+        if (QtOrmSlowLog::isEnabled())
+            _sample_values = values;
+    }
 }
 
 
@@ -166,8 +262,11 @@ bool QQuerySetPrivate::buildJoins(QList<Join> &joins, bool useSelectedFields)
     // Model to explore
     Join &join = joins.last();
 
-    // Allocate a table number for this model
-    join.model->setTableNumber(joins.count());
+    // Allocate a table number for this model. The main table is always T0, like
+    // in UPDATE and DELETE statements, so that filters built once against a
+    // model generate the same SQL whatever statement they are used in.
+    // Subqueries are numbered after the tables of the enclosing statement.
+    join.model->setTableNumber(_first_table + joins.count() - 1);
 
     // If one of the requested fields is in this model, we are useful
     bool useful_join = _selected_models.contains(join.model);
@@ -247,30 +346,37 @@ QList<QQuerySetPrivate::Join> QQuerySetPrivate::buildSelectedFields(bool for_rem
     }
 
     // Add the fields of every join to the list of the fields
-    for (int i=0; i<joins.count(); ++i)
-    {
-        const Join &join = joins.at(i);
-        int field_count = join.model->fieldsCount();
-
-        for (int j=0; j<field_count; ++j)
-        {
-            const QField &field = join.model->field(j);
-
-            if (!_excluded_fields.contains(field))
-            {
-                _selected_fields.append(field);
-            }
-        }
-    }
+    appendJoinedFields(joins);
 
     // Return the joins so other methods can use them
     return joins;
 }
 
-QString QQuerySetPrivate::buildSelect()
+QString QQuerySetPrivate::buildSelect(bool aliases)
 {
     QString rs;
 
+    // Remove the duplicate rows in the database, DISTINCT ON keeps the first
+    // row of each group of values
+    if (!_distinct_on.isEmpty() && hasDistinctOn())
+    {
+        rs += QLatin1String("DISTINCT ON (");
+
+        for (int i=0; i<_distinct_on.count(); ++i)
+        {
+            if (i != 0)
+                rs += QLatin1String(", ");
+
+            rs += _driver->escapeIdentifier(_distinct_on.at(i).fieldName(), QSqlDriver::FieldName);
+        }
+
+        rs += QLatin1String(") ");
+    }
+    else if (_distinct)
+    {
+        rs += QLatin1String("DISTINCT ");
+    }
+
     // Select all the selected fields
     for (int i=0; i<_selected_fields.count(); ++i)
     {
@@ -280,11 +386,46 @@ QString QQuerySetPrivate::buildSelect()
             rs += QLatin1String(", ");
 
         rs += _driver->escapeIdentifier(field.fieldName(), QSqlDriver::FieldName);
+
+        // Columns of different tables can have the same name, which derived
+        // tables do not accept
+        if (aliases)
+            rs += QString(" AS c%1").arg(i);
     }
 
     return rs;
 }
 
+bool QQuerySetPrivate::hasDistinctOn() const
+{
+    return _db.driverName().startsWith(QLatin1String("QPSQL"));
+}
+
+bool QQuerySetPrivate::numbersRows() const
+{
+    // Without DISTINCT ON, the first row of each group is kept like with setLimitPerGroup()
+    return _group_limit > 0 || (!_distinct_on.isEmpty() && !hasDistinctOn());
+}
+
+void QQuerySetPrivate::appendJoinedFields(const QList<Join> &joins)
+{
+    for (int i=0; i<joins.count(); ++i)
+    {
+        const Join &join = joins.at(i);
+        int field_count = join.model->fieldsCount();
+
+        for (int j=0; j<field_count; ++j)
+        {
+            const QField &field = join.model->field(j);
+
+            if (!_excluded_fields.contains(field))
+            {
+                _selected_fields.append(field);
+            }
+        }
+    }
+}
+
 QString QQuerySetPrivate::buildFrom(const QList<Join> &joins, bool for_remove)
 {
     QString rs;
@@ -325,7 +466,7 @@ QString QQuerySetPrivate::buildFrom(const QList<Join> &joins, bool for_remove)
     return rs;
 }
 
-QString QQuerySetPrivate::buildWhere(bool for_remove)
+QString QQuerySetPrivate::buildWhere()
 {
     QString rs;
 
@@ -336,16 +477,7 @@ QString QQuerySetPrivate::buildWhere(bool for_remove)
         else
             rs += QLatin1String(" AND ");
 
-        QString part = _filter.at(i).sql(_driver);
-
-        // If we delete, remove all allusions to T0
-        if (for_remove)
-        {
-            part.remove(QString("%1.")
-                        .arg(_driver->escapeIdentifier("T0", QSqlDriver::TableName)));
-        }
-
-        rs.append(part);
+        rs.append(_filter.at(i).sql(_driver));
     }
 
     return rs;
@@ -354,17 +486,27 @@ QString QQuerySetPrivate::buildWhere(bool for_remove)
 QString QQuerySetPrivate::buildOrderBy()
 {
     QString rs;
+    QVector<QPair<QField, bool> > order_by;
+
+    // PostgreSQL wants the DISTINCT ON expressions first in the ORDER BY clause
+    if (!_order_by.isEmpty() && !_distinct_on.isEmpty() && hasDistinctOn())
+    {
+        for (int i=0; i<_distinct_on.count(); ++i)
+            order_by.append(qMakePair(_distinct_on.at(i), true));
+    }
+
+    order_by += _order_by;
 
     // Build the ORDER BY part
-    for (int i=0; i<_order_by.count(); ++i)
+    for (int i=0; i<order_by.count(); ++i)
     {
         if (i == 0)
             rs = QLatin1String(" ORDER BY ");
         else
             rs += QLatin1String(", ");
 
-        rs += _driver->escapeIdentifier(_order_by.at(i).first.fieldName(), QSqlDriver::FieldName);
-        rs += _order_by.at(i).second ? " ASC" : " DESC";
+        rs += _driver->escapeIdentifier(order_by.at(i).first.fieldName(), QSqlDriver::FieldName);
+        rs += order_by.at(i).second ? " ASC" : " DESC";
     }
 
     return rs;
@@ -383,184 +525,1168 @@ QString QQuerySetPrivate::buildLimit()
     return rs;
 }
 
-void QQuerySetPrivate::build(bool for_remove)
+QString QQuerySetPrivate::buildLock()
 {
-    if (_built)
-        return;
+    if (_lock_mode == QQuerySet::NoLock)
+        return QString();
 
-    _built = true;
+    // SQLite locks the whole database when writing, and has no row locks
+    QString driver = _db.driverName();
 
-    // Joins used throughout
-    QList<QQuerySetPrivate::Join> joins = buildSelectedFields(for_remove);
+    if (!driver.startsWith(QLatin1String("QPSQL")) && !driver.startsWith(QLatin1String("QMYSQL")))
+        return QString();
 
+    // Only lock the rows of the main table, PostgreSQL refuses to lock the
+    // nullable side of a LEFT JOIN
+    QString rs(QLatin1String(" FOR UPDATE OF "));
 
-    // Build the query
-    QString q;
+    rs += _driver->escapeIdentifier(QString("T%1").arg(_first_table), QSqlDriver::TableName);
 
-    if (for_remove)
+    if (_lock_mode == QQuerySet::LockSkipLocked)
+        rs += QLatin1String(" SKIP LOCKED");
+    else if (_lock_mode == QQuerySet::LockNoWait)
+        rs += QLatin1String(" NOWAIT");
+
+    return rs;
+}
+
+bool QQuerySetPrivate::checkRowNumbers() const
+{
+    // Refuse what the derived table would silently change
+    if (!QtOrmDatabase::hasWindowFunctions(_db))
     {
-        q = QString("DELETE FROM %2%3;")
-            .arg(buildFrom(joins, true))
-            .arg(buildWhere(true));
+        qDebug() << "QQuerySet: setLimitPerGroup() and addDistinctOn() need window functions, that this"
+                 << _db.driverName() << "server does not have (SQLite 3.25, MySQL 8.0 and MariaDB 10.2 have them)";
+        return false;
     }
-    else
+
+    if (_distinct)
     {
-        q = QString("SELECT %1 FROM %2%3%4%5")
-            .arg(buildSelect())
-            .arg(buildFrom(joins, false))
-            .arg(buildWhere(false))
-            .arg(buildOrderBy())
-            .arg(buildLimit());
+        qDebug() << "QQuerySet: setDistinct() cannot be combined with setLimitPerGroup() and addDistinctOn()";
+        return false;
     }
 
-    // Prepare the query
-    _query.finish();
-
-    if (!_query.prepare(q))
+    if (_lock_mode != QQuerySet::NoLock)
     {
-        qDebug() << "Cannot prepare the query \"" << _query.lastQuery() << "\" :" << _query.lastError();
+        qDebug() << "QQuerySet: row locks cannot be combined with setLimitPerGroup() and addDistinctOn()";
+        return false;
     }
+
+    return true;
 }
 
-void QQuerySetPrivate::exec()
+QString QQuerySetPrivate::buildLimitPerGroup(const QList<Join> &joins)
 {
-    if (_executed)
-        return;
+    // Number the rows of each group in a derived table, and keep the first
+    // ones. The columns are aliased c0...cn, next() reads them in that order.
+    // addDistinctOn() keeps the first row of each group of its fields.
+    QVector<QField> groups;
+    int limit = _group_limit;
 
-    _executed = true;
+    if (limit > 0)
+    {
+        groups.append(_group_field);
+    }
+    else
+    {
+        groups = _distinct_on;
+        limit = 1;
+    }
 
-    // Bind the values
-    QVariantList values;
+    QString rs(QLatin1String("SELECT "));
+    QString partition;
+    QString outer_order;
 
-    for (int i=0; i<_filter.count(); ++i)
+    for (int i=0; i<_selected_fields.count(); ++i)
     {
-        _filter.at(i).bindValues(values);
+        if (i != 0)
+            rs += QLatin1String(", ");
+
+        rs += QString("c%1").arg(i);
     }
 
-    for (int i=0; i<values.count(); ++i)
+    rs += QLatin1String(" FROM (SELECT ") + buildSelect(true);
+
+    for (int i=0; i<groups.count(); ++i)
     {
-        _query.addBindValue(values.at(i));
+        QString group = _driver->escapeIdentifier(groups.at(i).fieldName(), QSqlDriver::FieldName);
+
+        if (i != 0)
+            partition += QLatin1String(", ");
+
+        partition += group;
+        rs += QString(", %1 AS qtorm_group%2").arg(group).arg(i);
+        outer_order += QString("qtorm_group%1, ").arg(i);
     }
 
-    if (!_query.exec())
+    // The rows are returned in the order of addOrderBy(), that may use
+    // columns that are not selected, or group by group without one
+    if (!_order_by.isEmpty())
+        outer_order.clear();
+
+    for (int i=0; i<_order_by.count(); ++i)
     {
-        qDebug() << "Cannot execute the query \"" << _query.lastQuery() << "\" :" << _query.lastError();
+        rs += QString(", %1 AS qtorm_order%2")
+            .arg(_driver->escapeIdentifier(_order_by.at(i).first.fieldName(), QSqlDriver::FieldName))
+            .arg(i);
+
+        outer_order += QString("qtorm_order%1%2, ").arg(i).arg(_order_by.at(i).second ? " ASC" : " DESC");
     }
+
+    rs += QLatin1String(", ROW_NUMBER() OVER (PARTITION BY ") + partition;
+    rs += buildOrderBy();
+    rs += QLatin1String(") AS qtorm_row FROM ") + buildFrom(joins, false);
+    rs += buildWhere();
+    rs += QLatin1String(") AS ") + _driver->escapeIdentifier(QLatin1String("grouped"), QSqlDriver::TableName);
+    rs += QString(" WHERE qtorm_row <= %1 ORDER BY ").arg(limit);
+    rs += outer_order + QLatin1String("qtorm_row");
+
+    return rs;
 }
 
-bool QQuerySetPrivate::next()
+void QQuerySetPrivate::build(bool for_remove)
 {
-    if (!_query.next())
-        return false;
-
-    // Get a row from the query and populate the model with it
-    for (int i=0; i<_selected_fields.count(); ++i)
-    {
-        _selected_fields[i].setRawData(_query.value(i));
-    }
+    if (!_built)
+        buildStatement(for_remove);
 
-    return true;
+    // The rows of a batched queryset are already there, preparing would cost a round trip
+    if (!_prepared && !_buffered && !_sql.isEmpty())
+        prepare();
 }
 
-bool QQuerySetPrivate::update(int *affectedRows)
+void QQuerySetPrivate::buildStatement(bool for_remove)
 {
-    // Build the list of fields to update
-    QString fields_part;
-    QVariantList values;
-    bool first = true;
+    if (_built)
+        return;
 
-    for (int i=0; i<_model->fieldsCount(); ++i)
+    QTORM_ALLOC_SCOPE(BuildOperation);
+    QtOrmSpan span(QtOrmTracer::BuildSpan);
+
+    _built = true;
+    database();
+
+    // Joins used throughout
+    _first_table = 0;
+
+    QList<QQuerySetPrivate::Join> joins = buildSelectedFields(for_remove);
+
+    // The filters of a DELETE may use related models, number them too
+    if (for_remove)
+        buildJoins(joins, false);
+
+    next_table_number = joins.count();
+    _tables.clear();
+
+    for (int i=0; i<joins.count(); ++i)
     {
-        const QField &f = _model->field(i);
+        _tables.append(joins.at(i).model->tableName());
+    }
 
-        if (f.isModified())
+    // Build the query
+    QString q;
+
+    if (for_remove)
+    {
+        // Built once, as building the subqueries numbers their tables
+        QString where_part = buildWhere();
+        QString table = _driver->escapeIdentifier(_model->tableName(), QSqlDriver::TableName);
+        bool subquery = false;
+
+        for (int i=0; i<_filter.count(); ++i)
+            subquery = subquery || _filter.at(i).hasSubquery();
+
+        // Removing T0 from a subquery would make its outer references point
+        // to its own tables, the rows are then selected like with joins
+        if (!subquery && !usesJoins(where_part, joins.count()))
         {
-            if (!first)
-                fields_part += QLatin1String(", ");
+            // DELETE FROM has no alias, remove all allusions to T0
+            where_part.remove(_driver->escapeIdentifier(QLatin1String("T0"), QSqlDriver::TableName) + QLatin1Char('.'));
 
-            fields_part += f.fieldName();
-            const QAssign &assign = f.assignation();
+            q = QString("DELETE FROM %2%3;")
+                .arg(table)
+                .arg(where_part);
+        }
+        else
+        {
+            // Not every database has a multi-table DELETE, select the rows
+            // to delete with the joins in a subquery
+            QString pk = _driver->escapeIdentifier(_model->pk().name(), QSqlDriver::FieldName);
+            QString subquery = QLatin1String("SELECT ");
 
-            if (!assign.isValid())
-            {
-                // No assignation, just an immediate value
-                fields_part += QLatin1String(" = ?");
-                values.append(f.data());
-            }
-            else
+            subquery += _driver->escapeIdentifier(_model->pk().fieldName(), QSqlDriver::FieldName);
+            subquery += QLatin1String(" FROM ") + buildFrom(joins, false) + where_part;
+
+            // MySQL cannot select from the table it deletes from, except through a derived table
+            if (_db.driverName().startsWith("QMYSQL"))
             {
-                // An assignation, append its SQL
-                fields_part += QLatin1String(" = ");
-                fields_part += assign.sql(_driver);
-                assign.bindValues(values);
+                subquery = QLatin1String("SELECT ") + pk + QLatin1String(" FROM (") + subquery;
+                subquery += QLatin1String(") AS ") + _driver->escapeIdentifier(QLatin1String("deleted"), QSqlDriver::TableName);
             }
 
-            first = false;
+            q = QLatin1String("DELETE FROM ") + table;
+            q += QLatin1String(" WHERE ") + pk + QLatin1String(" IN (") + subquery + QLatin1String(");");
+        }
+    }
+    else
+    {
+        if (numbersRows())
+        {
+            // Left empty when refused, exec() then fails
+            if (checkRowNumbers())
+                q = buildLimitPerGroup(joins) + buildLimit();
         }
+        else
+            q = QString("SELECT %1 FROM %2%3%4%5%6")
+                .arg(buildSelect(false))
+                .arg(buildFrom(joins, false))
+                .arg(buildWhere())
+                .arg(buildOrderBy())
+                .arg(buildLimit())
+                .arg(buildLock());
     }
 
-    if (fields_part.isEmpty())
-        return true;
+    _sql = q;
+    span.setSql(_sql);
+}
 
-    // Whole SQL
-    QString sql = QString("UPDATE %0 AS T0 SET %1%2;")
-        .arg(_driver->escapeIdentifier(_model->tableName(), QSqlDriver::TableName))
-        .arg(fields_part)
-        .arg(buildWhere(false));
+void QQuerySetPrivate::prepare()
+{
+    QtOrmSpan span(QtOrmTracer::PrepareSpan);
+    QElapsedTimer timer;
+    bool ok;
 
-    // Bind values for where
-    for (int i=0; i<_filter.count(); ++i)
-    {
-        _filter.at(i).bindValues(values);
-    }
+    span.setSql(_sql);
 
-    // Prepare and run the query
+    if (QtOrmStats::isTimed())
+        timer.start();
+
+    // Prepare the query, or take an already prepared one
     _query.finish();
-    _query.prepare(sql);
+    _query = QtOrmDatabase::takePreparedQuery(_db, _sql, &ok);
+    _prepared = ok;
 
-    for (int i=0; i<values.count(); ++i)
+    if (timer.isValid())
+        _sample.prepareNsecs = timer.nsecsElapsed();
+
+    if (!ok)
     {
-        _query.addBindValue(values.at(i));
+        qDebug() << "Cannot prepare the query \"" << _query.lastQuery() << "\" :" << _query.lastError();
     }
+}
+
+QString QQuerySetPrivate::subquerySql(QSqlDriver *driver)
+{
+    // The SELECT is generated each time the enclosing statement is built, as
+    // its table numbers depend on the tables used around it
+    QMutexLocker locker(&subquery_mutex);
+
+    (void) driver;
+    database();
 
-    if (!_query.exec())
+    bool select_pk = _selected_fields.isEmpty();
+
+    _first_table = next_table_number;
+
+    QList<QQuerySetPrivate::Join> joins = buildSelectedFields(false);
+
+    next_table_number = _first_table + joins.count();
+
+    QString rs(QLatin1String("SELECT "));
+
+    if (select_pk)
     {
-        qDebug() << _query.lastError();
-        return false;
+        // Only one column can be compared, default to the primary key. All
+        // the joins are kept, as the filters may use them.
+        rs += _driver->escapeIdentifier(_model->pk().fieldName(), QSqlDriver::FieldName);
+        _selected_fields.clear();
+    }
+    else
+    {
+        rs += buildSelect(false);
     }
 
-    if (affectedRows)
-        *affectedRows = _query.numRowsAffected();
+    if (numbersRows())
+        qDebug() << "QQuerySet: setLimitPerGroup() and addDistinctOn() without DISTINCT ON are ignored in subqueries";
 
-    return true;
+    rs += QLatin1String(" FROM ");
+    rs += buildFrom(joins, false);
+    rs += buildWhere();
+    rs += buildOrderBy();
+    rs += buildLimit();
+
+    return rs;
 }
 
-void QQuerySetPrivate::reset()
+QString QQuerySetPrivate::inlineValues(const QString &sql, const QVariantList &values, QSqlDriver *driver)
 {
-    _built = false;
-    _executed = false;
+    // For statements that cannot be prepared, the values are formatted by the
+    // driver. QtORM only uses '?' as a placeholder, so any other '?' is in a
+    // literal or an identifier: the statement is then refused (null string).
+    if (sql.count(QChar('?')) != values.count())
+        return QString();
+
+    QString rs;
+    int value = 0;
+
+    for (int i=0; i<sql.size(); ++i)
+    {
+        if (sql.at(i) != QLatin1Char('?'))
+        {
+            rs += sql.at(i);
+            continue;
+        }
+
+        QSqlField field(QString(), values.at(value).type());
+
+        field.setValue(values.at(value++));
+        rs += driver->formatValue(field);
+    }
+
+    return rs;
+}
+
+void QQuerySetPrivate::bindValues(QVariantList &values) const
+{
+    QTORM_ALLOC_SCOPE(BindOperation);
+
+    for (int i=0; i<_filter.count(); ++i)
+    {
+        _filter.at(i).bindValues(values, _driver);
+    }
+}
+
+bool QQuerySetPrivate::setUpFilters(const QSqlDatabase &db)
+{
+    for (int i=0; i<_filter.count(); ++i)
+    {
+        if (!_filter.at(i).setUp(db))
+        {
+            // Nothing stays set up when it fails, the filters may be shared
+            // with statements that still use their temporary tables
+            for (int j=0; j<i; ++j)
+                _filter.at(j).tearDown(db);
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void QQuerySetPrivate::tearDownFilters(const QSqlDatabase &db)
+{
+    for (int i=0; i<_filter.count(); ++i)
+    {
+        _filter.at(i).tearDown(db);
+    }
+}
+
+bool QQuerySetPrivate::exec()
+{
+    if (_executed)
+        return true;
+
+    _executed = true;
+
+    // The statement was refused when it was built
+    if (_sql.isEmpty())
+        return false;
+
+    _chunk_row = 0;
+    _chunk_rows.clear();
+
+    // Bind the values and run the query, retrying transient errors
+    QtOrmSpan span(QtOrmTracer::ExecSpan);
+    QElapsedTimer timer;
+    QVariantList values;
+
+    span.setSql(_sql);
+
+    // Temporary tables of large IN lists, emptied by finishStatement()
+    if (!setUpFilters(_db))
+        return false;
+
+    _filters_set_up = true;
+
+    bindValues(values);
+
+    // In development mode, look for full scans of large tables
+    checkPlan();
+
+    if (QtOrmStats::isTimed())
+        timer.start();
+
+    if (!QtOrmDatabase::execQuery(_query, _db, values))
+    {
+        qDebug() << "Cannot execute the query \"" << _query.lastQuery() << "\" :" << _query.lastError();
+        return false;
+    }
+
+    // Don't let a retry reconnect while the rows are being read
+    QtOrmDatabase::holdConnection(_db);
+    _holds_connection = true;
+
+    if (timer.isValid())
+    {
+        _sample.execNsecs = timer.nsecsElapsed();
+        _sample_pending = true;
+
+        if (QtOrmSlowLog::isEnabled())
+            _sample_values = values;
+    }
+
+    return true;
+}
+
+void QQuerySetPrivate::finishStatement()
+{
+    if (_fetch_span)
+    {
+        delete _fetch_span;
+        _fetch_span = NULL;
+    }
+
+    if (_holds_connection)
+    {
+        QtOrmDatabase::releaseConnection(_db);
+        _holds_connection = false;
+    }
+
+    if (_filters_set_up)
+    {
+        // The tables used by the statement cannot be dropped while it runs
+        _query.finish();
+        tearDownFilters(_db);
+        _filters_set_up = false;
+    }
+
+    if (!_sample_pending)
+        return;
+
+    if (QtOrmStats::isEnabled())
+    {
+        if (_stats_sql.isEmpty())
+            _stats_sql = QtOrmStats::normalize(_sql);
+
+        QtOrmStats::record(_stats_sql, _sample);
+    }
+
+    // The statements of a QQueryBatch were not run by _query
+    QtOrmSlowLog::log(_buffered ? _sql : _query.lastQuery(), _sample_values, _sample);
+
+    _sample = QtOrmStatementSample();
+    _sample_values.clear();
+    _sample_pending = false;
+}
+
+bool QQuerySetPrivate::next()
+{
+    QTORM_ALLOC_SCOPE(OtherOperation);
+    QElapsedTimer timer;
+
+    if (_sample_pending)
+        timer.start();
+
+    // The fetch span lasts until the last row, or until the statement is finished
+    if (!_fetch_span && QtOrmTracer::tracer())
+    {
+        _fetch_span = new QtOrmSpan(QtOrmTracer::FetchSpan);
+        _fetch_span->setSql(_sql);
+        _fetch_span->setRows(0);
+    }
+
+    // The rows come from _query, from a QQueryBatch, or from the chunk read
+    // ahead to prefetch the reverse relations
+    bool fetched;
+
+    if (!_prefetch_related.isEmpty())
+        fetched = (_chunk_row < _chunk_rows.count() || fetchChunk());
+    else if (_buffered)
+        fetched = (_buffered_row < _buffered_rows.count());
+    else
+        fetched = _query.next();
+
+    if (!fetched)
+    {
+        if (_sample_pending)
+            _sample.fetchNsecs += timer.nsecsElapsed();
+
+        finishStatement();
+
+        if (current_iteration == this)
+            current_iteration = NULL;
+
+        return false;
+    }
+
+    // Get a row from the query and populate the model with it
+    {
+        QTORM_ALLOC_SCOPE(HydrateOperation);
+
+        if (_prefetch_related.isEmpty() && !_buffered)
+        {
+            for (int i=0; i<_selected_fields.count(); ++i)
+            {
+                _selected_fields[i].setRawData(_query.value(i));
+            }
+        }
+        else
+        {
+            const QVariantList &row = (_prefetch_related.isEmpty() ? _buffered_rows.at(_buffered_row++) : _chunk_rows.at(_chunk_row++));
+
+            for (int i=0; i<_selected_fields.count(); ++i)
+            {
+                _selected_fields[i].setRawData(row.at(i));
+            }
+        }
+    }
+
+    if (_sample_pending)
+    {
+        _sample.fetchNsecs += timer.nsecsElapsed();
+        _sample.rowsReturned++;
+    }
+
+    if (_fetch_span)
+        _fetch_span->addRow();
+
+    current_iteration = this;
+    return true;
+}
+
+bool QQuerySetPrivate::fetchChunk()
+{
+    // Read the next rows ahead, and load the children of all of them at once
+    _chunk_row = 0;
+    _chunk_rows.clear();
+
+    {
+        QTORM_ALLOC_SCOPE(HydrateOperation);
+
+        while (_chunk_rows.count() < _prefetch_chunk)
+        {
+            if (_buffered)
+            {
+                if (_buffered_row >= _buffered_rows.count())
+                    break;
+
+                _chunk_rows.append(_buffered_rows.at(_buffered_row++));
+                continue;
+            }
+
+            if (!_query.next())
+                break;
+
+            QVariantList row;
+
+            for (int i=0; i<_selected_fields.count(); ++i)
+                row.append(_query.value(i));
+
+            _chunk_rows.append(row);
+        }
+    }
+
+    if (_chunk_rows.isEmpty())
+        return false;
+
+    for (int r=0; r<_prefetch_related.count(); ++r)
+    {
+        QReverseRelationPrivate *relation = _prefetch_related.at(r);
+        int pk = _selected_fields.indexOf(relation->model()->pk());
+
+        if (pk == -1)
+        {
+            // The children will be loaded row by row
+            qDebug() << "Cannot prefetch" << relation->foreignKey() << ": the primary key of"
+                     << relation->model()->tableName() << "is not selected";
+            continue;
+        }
+
+        QVariantList keys;
+
+        for (int i=0; i<_chunk_rows.count(); ++i)
+        {
+            const QVariant &key = _chunk_rows.at(i).at(pk);
+
+            if (!key.isNull())
+                keys.append(key);
+        }
+
+        relation->load(keys);
+    }
+
+    return true;
+}
+
+QQuerySetPrivate *QQuerySetPrivate::currentIteration()
+{
+    return current_iteration;
+}
+
+void QQuerySetPrivate::setCurrentIteration(QQuerySetPrivate *queryset)
+{
+    current_iteration = queryset;
+}
+
+void QQuerySetPrivate::foreignKeyQuery(const QForeignKeyPrivate *foreignKey)
+{
+    int &queries = _foreignkey_queries[foreignKey];
+    int threshold = QtOrmDiagnostics::nPlusOneThreshold();
+
+    // Only reported once, when the threshold is crossed
+    if (++queries != threshold + 1)
+        return;
+
+    QtOrmDiagnostics::reportNPlusOne(
+        QString("N+1 queries: %1.%2 was dereferenced %3 times while iterating over \"%4\", "
+                "use QQuerySet::addSelectRelated() to fetch it in the same query")
+            .arg(foreignKey->model()->tableName())
+            .arg(foreignKey->name())
+            .arg(queries)
+            .arg(_sql));
+}
+
+int QQuerySetPrivate::count()
+{
+    QtOrmSpan span(QtOrmTracer::ExecSpan);
+    QString sql;
+
+    {
+        QTORM_ALLOC_SCOPE(BuildOperation);
+
+        database();
+
+        // All the related models are joined, as the filters may use any of
+        // them. The selected fields are restored: count() may be called
+        // before and after next(), which builds its statement once.
+        QList<Join> joins;
+        Join start_join;
+        QVector<QField> selected = _selected_fields;
+
+        start_join.model = _model;
+        start_join.parent_foreignkey = NULL;
+        start_join.accepts_null = false;
+
+        joins.append(start_join);
+
+        _first_table = 0;
+        buildJoins(joins, false);
+        next_table_number = joins.count();
+
+        // The fields next() selects when none is given, for DISTINCT
+        if (_selected_models.isEmpty())
+        {
+            _selected_fields.clear();
+            appendJoinedFields(joins);
+        }
+
+        if (numbersRows())
+        {
+            if (!checkRowNumbers())
+            {
+                _selected_fields = selected;
+                return -1;
+            }
+
+            sql = QLatin1String("SELECT COUNT(*) FROM (");
+            sql += buildLimitPerGroup(joins);
+            sql += buildLimit();
+            sql += QLatin1String(") AS ");
+            sql += _driver->escapeIdentifier(QLatin1String("counted"), QSqlDriver::TableName);
+        }
+        else if (_distinct || !_distinct_on.isEmpty() || _limit || _offset)
+        {
+            // Count the rows the SELECT would return, without transferring them
+            sql = QLatin1String("SELECT COUNT(*) FROM (SELECT ");
+            sql += buildSelect(true);
+            sql += QLatin1String(" FROM ") + buildFrom(joins, false);
+            sql += buildWhere();
+            sql += buildLimit();
+            sql += QLatin1String(") AS ");
+            sql += _driver->escapeIdentifier(QLatin1String("counted"), QSqlDriver::TableName);
+        }
+        else
+        {
+            sql = QLatin1String("SELECT COUNT(*) FROM ");
+            sql += buildFrom(joins, false);
+            sql += buildWhere();
+        }
+
+        _selected_fields = selected;
+    }
+
+    QVariantList values;
+
+    if (!setUpFilters(_db))
+        return -1;
+
+    bindValues(values);
+    span.setSql(sql);
+
+    // Prepare and run the query
+    QtOrmStatementSample sample;
+    QElapsedTimer timer;
+    bool timed = QtOrmStats::isTimed();
+    bool prepared;
+    int rs = -1;
+
+    if (timed)
+        timer.start();
+
+    QSqlQuery query = QtOrmDatabase::takePreparedQuery(_db, sql, &prepared);
+
+    if (timed)
+    {
+        sample.prepareNsecs = timer.nsecsElapsed();
+        timer.restart();
+    }
+
+    if (!QtOrmDatabase::execQuery(query, _db, values))
+        qDebug() << "Cannot execute the query \"" << query.lastQuery() << "\" :" << query.lastError();
+    else if (query.next())
+        rs = query.value(0).toInt();
+
+    query.finish();
+    tearDownFilters(_db);
+
+    if (timed)
+    {
+        sample.execNsecs = timer.nsecsElapsed();
+        sample.rowsReturned = 1;
+
+        if (QtOrmStats::isEnabled())
+            QtOrmStats::record(QtOrmStats::normalize(sql), sample);
+
+        QtOrmSlowLog::log(query.lastQuery(), values, sample);
+    }
+
+    if (prepared)
+        QtOrmDatabase::recycleQuery(query);
+
+    return rs;
+}
+
+bool QQuerySetPrivate::claim()
+{
+    QString driver_name;
+    QVariantList values;
+
+    {
+        QTORM_ALLOC_SCOPE(BuildOperation);
+        QtOrmSpan span(QtOrmTracer::BuildSpan);
+
+        database();
+        driver_name = _db.driverName();
+
+        if (!driver_name.startsWith(QLatin1String("QSQLITE")) && !driver_name.startsWith(QLatin1String("QPSQL")))
+        {
+            qDebug() << "claim() needs UPDATE ... RETURNING, which" << driver_name << "does not have."
+                     << "Use LockSkipLocked in a transaction, and update the selected rows.";
+            return false;
+        }
+
+        if (_built)
+        {
+            qDebug() << "claim() must be called on a queryset that has not been run yet";
+            return false;
+        }
+
+        _built = true;
+
+        // The rows to claim are selected with all the joins the filters need,
+        // then the main table is updated and its columns are returned
+        QVector<QField> selected = _selected_fields;
+
+        _first_table = 0;
+        _selected_fields.clear();
+
+        QList<QQuerySetPrivate::Join> joins = buildSelectedFields(false);
+
+        next_table_number = joins.count();
+        _selected_fields.clear();
+
+        for (int i=0; i<_model->fieldsCount(); ++i)
+        {
+            const QField &field = _model->field(i);
+
+            if ((selected.isEmpty() && !_excluded_fields.contains(field)) || selected.contains(field))
+                _selected_fields.append(field);
+        }
+
+        QString fields_part = buildSet(values, false);
+
+        if (fields_part.isEmpty())
+        {
+            qDebug() << "claim() has no modified field to update";
+            return false;
+        }
+
+        // Concurrent PostgreSQL workers skip the rows already being claimed,
+        // SQLite serializes the writers
+        if (_lock_mode == QQuerySet::NoLock)
+            _lock_mode = QQuerySet::LockSkipLocked;
+
+        QString pk = _driver->escapeIdentifier(_model->pk().fieldName(), QSqlDriver::FieldName);
+        QString sql;
+
+        sql = QLatin1String("UPDATE ");
+        sql += _driver->escapeIdentifier(_model->tableName(), QSqlDriver::TableName);
+        sql += QLatin1String(" AS T0 SET ") + fields_part;
+        sql += QLatin1String(" WHERE ") + pk + QLatin1String(" IN (SELECT ") + pk;
+        sql += QLatin1String(" FROM ") + buildFrom(joins, false);
+        sql += buildWhere();
+        sql += buildOrderBy();
+        sql += buildLimit();
+        sql += buildLock();
+        sql += QLatin1String(") RETURNING ");
+
+        for (int i=0; i<_selected_fields.count(); ++i)
+        {
+            if (i != 0)
+                sql += QLatin1String(", ");
+
+            sql += _driver->escapeIdentifier(_selected_fields.at(i).name(), QSqlDriver::FieldName);
+        }
+
+        _sql = sql;
+        span.setSql(_sql);
+    }
+
+    // The statement returns the claimed rows, read by next()
+    prepare();
+
+    if (!_prepared)
+        return false;
+
+    _executed = true;
+
+    if (!setUpFilters(_db))
+        return false;
+
+    _filters_set_up = true;
+
+    bindValues(values);
+
+    QtOrmSpan span(QtOrmTracer::UpdateSpan);
+    QElapsedTimer timer;
+
+    span.setSql(_sql);
+
+    if (QtOrmStats::isTimed())
+        timer.start();
+
+    if (!QtOrmDatabase::execQuery(_query, _db, values))
+    {
+        qDebug() << "Cannot execute the query \"" << _query.lastQuery() << "\" :" << _query.lastError();
+        return false;
+    }
+
+    if (timer.isValid())
+    {
+        _sample.execNsecs = timer.nsecsElapsed();
+        _sample_pending = true;
+
+        if (QtOrmSlowLog::isEnabled())
+            _sample_values = values;
+    }
+
+    return true;
+}
+
+QString QQuerySetPrivate::buildSet(QVariantList &values, bool qualified) const
+{
+    QString rs;
+
+    for (int i=0; i<_model->fieldsCount(); ++i)
+    {
+        const QField &f = _model->field(i);
+
+        if (f.isModified())
+        {
+            if (!rs.isEmpty())
+                rs += QLatin1String(", ");
+
+            // SET only accepts plain column names, except in the multi-table
+            // UPDATE of MySQL where they may be ambiguous
+            rs += _driver->escapeIdentifier(qualified ? f.fieldName() : f.name(), QSqlDriver::FieldName);
+            const QAssign &assign = f.assignation();
+
+            if (!assign.isValid())
+            {
+                // No assignation, just an immediate value
+                rs += QLatin1String(" = ?");
+                values.append(f.data());
+            }
+            else
+            {
+                // An assignation, append its SQL
+                rs += QLatin1String(" = ");
+                rs += assign.sql(_driver);
+                assign.bindValues(values);
+            }
+        }
+    }
+
+    return rs;
+}
+
+bool QQuerySetPrivate::remove(int *affectedRows)
+{
+    build(true);
+
+    bool ok = exec();
+
+    if (ok)
+    {
+        int rows = _query.numRowsAffected();
+
+        if (_sample_pending)
+            _sample.rowsAffected = rows;
+
+        if (affectedRows)
+            *affectedRows = rows;
+    }
+
+    finishStatement();
+
+    return ok;
+}
+
+bool QQuerySetPrivate::usesJoins(const QString &sql, int tables) const
+{
+    // Columns of the joined tables are written "T1"."column"
+    for (int i=1; i<tables; ++i)
+    {
+        QString prefix = _driver->escapeIdentifier(QString("T%1").arg(i), QSqlDriver::TableName);
+
+        if (sql.contains(prefix + QLatin1Char('.')))
+            return true;
+    }
+
+    return false;
+}
+
+bool QQuerySetPrivate::update(int *affectedRows)
+{
+    QTORM_ALLOC_SCOPE(BuildOperation);
+    QtOrmSpan span(QtOrmTracer::UpdateSpan);
+
+    database();
+
+    // The updated table is T0, whatever the last statement of the model, and
+    // the related models are numbered after it like in a SELECT
+    QList<Join> joins;
+    Join start_join;
+
+    start_join.model = _model;
+    start_join.parent_foreignkey = NULL;
+    start_join.accepts_null = false;
+
+    joins.append(start_join);
+
+    _first_table = 0;
+    buildJoins(joins, false);
+    next_table_number = joins.count();
+
+    // Build the list of fields to update
+    QVariantList values;
+    QString fields_part = buildSet(values, false);
+
+    if (fields_part.isEmpty())
+        return true;
+
+    QString where_part = buildWhere();
+    QString table = _driver->escapeIdentifier(_model->tableName(), QSqlDriver::TableName);
+    bool joined_set = usesJoins(fields_part, joins.count());
+    QString sql;
+
+    if (!joined_set && !usesJoins(where_part, joins.count()))
+    {
+        // Only the columns of the updated table are used
+        sql = QString("UPDATE %0 AS T0 SET %1%2;")
+            .arg(table)
+            .arg(fields_part)
+            .arg(where_part);
+    }
+    else if (_db.driverName().startsWith("QMYSQL"))
+    {
+        // Multi-table UPDATE, MySQL does not accept a subquery on the updated table
+        values.clear();
+        fields_part = buildSet(values, true);
+
+        sql = QLatin1String("UPDATE ") + buildFrom(joins, false);
+        sql += QLatin1String(" SET ") + fields_part + where_part + QLatin1String(";");
+    }
+    else if (joined_set || _db.driverName().startsWith("QPSQL"))
+    {
+        // UPDATE ... FROM (PostgreSQL, SQLite 3.33). The joins are made from
+        // a copy of T0, matched on the primary key, so that the LEFT JOINs
+        // keep their meaning and the SET expressions can use T0...Tn.
+        QString pk = _driver->escapeIdentifier(_model->pk().name(), QSqlDriver::FieldName);
+
+        sql = QLatin1String("UPDATE ") + table + QLatin1String(" AS qtorm_updated SET ") + fields_part;
+        sql += QLatin1String(" FROM ") + buildFrom(joins, false);
+        sql += QLatin1String(" WHERE qtorm_updated.") + pk + QLatin1String(" = ");
+        sql += _driver->escapeIdentifier(_model->pk().fieldName(), QSqlDriver::FieldName);
+
+        if (!where_part.isEmpty())
+            sql += QLatin1String(" AND (") + where_part.mid(7) + QLatin1String(")");    // Without " WHERE "
+
+        sql += QLatin1String(";");
+    }
+    else
+    {
+        // Only the filters use the related models, select the rows to update
+        // in a subquery. The assignations use the updated table as T0, the
+        // subquery has its own T0.
+        QString pk = _driver->escapeIdentifier(_model->pk().name(), QSqlDriver::FieldName);
+
+        sql = QLatin1String("UPDATE ") + table + QLatin1String(" AS T0 SET ") + fields_part;
+        sql += QLatin1String(" WHERE ") + pk + QLatin1String(" IN (SELECT ");
+        sql += _driver->escapeIdentifier(_model->pk().fieldName(), QSqlDriver::FieldName);
+        sql += QLatin1String(" FROM ") + buildFrom(joins, false) + where_part + QLatin1String(");");
+    }
+
+    // Bind values for where
+    if (!setUpFilters(_db))
+        return false;
+
+    bindValues(values);
+    span.setSql(sql);
+
+    // Prepare and run the query
+    QtOrmStatementSample sample;
+    QElapsedTimer timer;
+    bool timed = QtOrmStats::isTimed();
+    bool prepared;
+
+    if (timed)
+        timer.start();
+
+    QSqlQuery query = QtOrmDatabase::takePreparedQuery(_db, sql, &prepared);
+
+    if (timed)
+    {
+        sample.prepareNsecs = timer.nsecsElapsed();
+        timer.restart();
+    }
+
+    bool ok = QtOrmDatabase::execQuery(query, _db, values);
+
+    tearDownFilters(_db);
+
+    if (!ok)
+    {
+        qDebug() << query.lastError();
+        return false;
+    }
+
+    if (timed)
+    {
+        sample.execNsecs = timer.nsecsElapsed();
+        sample.rowsAffected = query.numRowsAffected();
+
+        if (QtOrmStats::isEnabled())
+            QtOrmStats::record(QtOrmStats::normalize(sql), sample);
+
+        QtOrmSlowLog::log(query.lastQuery(), values, sample);
+    }
+
+    span.setRows(query.numRowsAffected());
+
+    if (affectedRows)
+        *affectedRows = query.numRowsAffected();
+
+    if (prepared)
+        QtOrmDatabase::recycleQuery(query);
+
+    return true;
+}
+
+void QQuerySetPrivate::reset()
+{
+    finishStatement();
+
+    if (_prepared)
+    {
+        QtOrmDatabase::recycleQuery(_query);
+        _query = QSqlQuery(_db);
+    }
+
+    _built = false;
+    _prepared = false;
+    _executed = false;
+    _buffered = false;
+    _buffered_row = 0;
+    _buffered_rows.clear();
+    _chunk_row = 0;
+    _chunk_rows.clear();
+    _sql.clear();
+    _tables.clear();
+    _stats_sql.clear();
+    _foreignkey_queries.clear();
+
+    if (current_iteration == this)
+        current_iteration = NULL;
 
     _selected_fields.clear();
     _excluded_fields.clear();
     _select_related.clear();
+    clearPrefetchRelated();
     _filter.clear();
     _order_by.clear();
+    _distinct = false;
+    _distinct_on.clear();
+    _lock_mode = QQuerySet::NoLock;
+    _group_field = QField();
+    _group_limit = 0;
     _query.finish();
 }
 
+qint64 QQuerySetPrivate::heapSize() const
+{
+    // The fields belong to the models, only the arrays referencing them are
+    // counted. QSqlQuery keeps its buffers in the driver, out of our reach.
+    qint64 rs = sizeof(*this);
+
+    rs += qtormHeapSize(_sql);
+    rs += qtormHeapSize(_tables);
+    rs += qtormVectorHeapSize(_selected_fields);
+    rs += qtormHeapSize(_excluded_fields);
+    rs += qtormHeapSize(_selected_models);
+    rs += qtormVectorHeapSize(_select_related);
+    rs += qtormVectorHeapSize(_filter);
+    rs += qtormVectorHeapSize(_order_by);
+    rs += qtormVectorHeapSize(_distinct_on);
+
+    for (int i=0; i<_filter.count(); ++i)
+        rs += _filter.at(i).heapSize();
+
+    rs += qtormHeapSize(_sample_values);
+    rs += qtormHeapSize(_stats_sql);
+    rs += qtormHeapSize(_foreignkey_queries);
+    rs += qtormHeapSize(_buffered_rows);
+    rs += qtormVectorHeapSize(_prefetch_related);
+    rs += qtormHeapSize(_chunk_rows);
+
+    return rs;
+}
+
 /*
  * QuerySet
  */
 
 
 QQuerySet::QQuerySet(QModel *model)
-: d(new QQuerySetPrivate(model, QtOrmDatabase::threadDatabase()))
+: d(new QQuerySetPrivate(model))
 {
 }
 
 QQuerySet::~QQuerySet()
 {
-    delete d;
+    // Filters using the queryset as a subquery may still reference it
+    if (!d->deref())
+        delete d;
 }
 
 void QQuerySet::addSelectRelated_p(const QField &field)
@@ -568,6 +1694,16 @@ void QQuerySet::addSelectRelated_p(const QField &field)
     d->addSelectRelated(field);
 }
 
+void QQuerySet::checkThreadDatabase()
+{
+    d->checkThreadDatabase();
+}
+
+void QQuerySet::addPrefetchRelated_p(QReverseRelationPrivate *relation, int chunkSize)
+{
+    d->addPrefetchRelated(relation, chunkSize);
+}
+
 void QQuerySet::addFilter(const QWhere &cond)
 {
     d->addFilter(cond);
@@ -616,15 +1752,59 @@ bool QQuerySet::next()
     return d->next();
 }
 
+void QQuerySet::setDistinct(bool distinct)
+{
+    d->setDistinct(distinct);
+}
+
+void QQuerySet::addDistinctOn(const QField &field)
+{
+    d->addDistinctOn(field);
+}
+
+void QQuerySet::setLockMode(LockMode mode)
+{
+    d->setLockMode(mode);
+}
+
+void QQuerySet::setLimitPerGroup(const QField &groupBy, int count)
+{
+    d->setLimitPerGroup(groupBy, count);
+}
+
+bool QQuerySet::claim()
+{
+    return d->claim();
+}
+
+int QQuerySet::count()
+{
+    return d->count();
+}
+
 bool QQuerySet::update(int *affectedRows)
 {
     return d->update(affectedRows);
 }
 
-void QQuerySet::remove()
+qint64 QQuerySet::heapSize() const
 {
-    d->build(true);
-    d->exec();
+    return sizeof(*this) + d->heapSize();
+}
+
+QQueryPlan QQuerySet::explain()
+{
+    return d->explain();
+}
+
+void QQuerySet::setDevelopmentMode(bool enable, int largeTableRows)
+{
+    QQuerySetPrivate::setDevelopmentMode(enable, largeTableRows);
+}
+
+bool QQuerySet::remove(int *affectedRows)
+{
+    return d->remove(affectedRows);
 }
 
 void QQuerySet::reset()
@@ -26,26 +26,70 @@
 #include "qfield.h"
 #include "qf.h"
 #include "qforeignkey.h"
+#include "qreverserelation.h"
+#include "qqueryplan.h"
 
 class QSqlDatabase;
 
 class QModel;
+class QtOrmExecutor;
+class QQuerySetNextAwaiter;
 
 class QQuerySet
 {
+    friend class QQueryBatch;
+    friend class QFSubqueryWhere;
+    friend class QExistsWhere;
+    friend class QQuerySetNextAwaiter;
+
     private:
         Q_DISABLE_COPY(QQuerySet)
 
+    public:
+        enum LockMode
+        {
+            NoLock,
+            LockForUpdate,      /*!< @brief SELECT ... FOR UPDATE, other transactions wait for the selected rows */
+            LockSkipLocked,     /*!< @brief FOR UPDATE SKIP LOCKED, rows locked by other transactions are not returned */
+            LockNoWait          /*!< @brief FOR UPDATE NOWAIT, fail instead of waiting for locked rows */
+        };
+
     public:
         QQuerySet(QModel *model);
         ~QQuerySet();
 
         template<typename T>
         void addSelectRelated(const QForeignKey<T> &field);
+
+        /**
+         * @brief Load the children of relation for chunks of rows
+         *
+         * The rows are read chunkSize at a time, and the children of all the
+         * rows of a chunk are loaded in one query, filtered on the foreign key
+         * with IN. The primary key of the model of relation must be selected.
+         * The smallest chunkSize given to the queryset is used.
+         */
+        template<typename T>
+        void addPrefetchRelated(const QReverseRelation<T> &relation, int chunkSize = 100);
         void addFilter(const QWhere &cond);
         void addOrderBy(const QField &field, bool asc);
         void setLimit(int count);
         void setOffset(int val);
+        void setDistinct(bool distinct = true);    /*!< @brief Remove the duplicate rows in the database */
+        void addDistinctOn(const QField &field);  /*!< @brief Keep the first row per value of field, with DISTINCT ON on PostgreSQL and ROW_NUMBER() elsewhere */
+
+        /**
+         * @brief Only return the first count rows of each value of groupBy
+         *
+         * The rows of each group are ordered by the addOrderBy() fields, and
+         * numbered with ROW_NUMBER() in a derived table, so the database
+         * needs window functions (PostgreSQL, MySQL 8, SQLite 3.25). The
+         * rows are returned in the addOrderBy() order, or group by group
+         * without one. setLimit() and setOffset() apply to the whole result.
+         * The statement is refused, and reported with qDebug(), without
+         * window functions or with setDistinct() or a row lock.
+         */
+        void setLimitPerGroup(const QField &groupBy, int count);
 
         // Gestion des champs
         void excludeField(const QField &field);
@@ -56,14 +100,60 @@ class QQuerySet
 
         QString sql(bool for_remove = false);
         bool next();
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+        QQuerySetNextAwaiter nextAsync(QtOrmExecutor *executor = 0);   /*!< @brief co_await-able next(), see qtormcoro.h */
+#endif
         bool update(int *affectedRows = 0);
-        void remove();
+        int count();    /*!< @brief Number of rows the queryset returns, -1 on error */
+
+        /**
+         * @brief Lock the selected rows of the main table until the end of the transaction
+         *
+         * Generated on PostgreSQL and MySQL 8, ignored on SQLite, which
+         * locks the whole database for writing. Use claim() there.
+         */
+        void setLockMode(LockMode mode);
+
+        /**
+         * @brief Atomically update the rows of the queryset, and iterate them
+         *
+         * The modified fields of the model are written to the rows matched by
+         * the filters, up to the limit, in one UPDATE ... RETURNING statement.
+         * next() then iterates the claimed rows. As the statement re-checks
+         * the filters (for instance QF(job.worker).isNull()) while holding
+         * the write lock, concurrent workers claim disjoint rows. Supported by
+         * SQLite 3.35 and PostgreSQL, where the rows are selected with
+         * FOR UPDATE SKIP LOCKED unless another lock mode is set.
+         */
+        bool claim();
+
+        /**
+         * @brief Delete the rows matched by the filters
+         *
+         * Filters on related models are supported: the rows to delete are
+         * then selected with the joins in a WHERE pk IN (SELECT ...) subquery.
+         */
+        bool remove(int *affectedRows = 0);
         void reset();
 
+        QQueryPlan explain();
+        qint64 heapSize() const;   /*!< @brief Approximate heap bytes held by the queryset, without the driver buffers */
+
+        /**
+         * @brief Check the plan of every new statement, and report full scans of large tables
+         *
+         * The plans are checked once per statement and per thread, with
+         * qDebug(). Only meant for development, as explaining a statement
+         * and counting the rows of a table cost a few round trips.
+         */
+        static void setDevelopmentMode(bool enable, int largeTableRows = 10000);
+
     private:
         QQuerySetPrivate *d;
 
         void addSelectRelated_p(const QField &field);
+        void checkThreadDatabase();
+        void addPrefetchRelated_p(QReverseRelationPrivate *relation, int chunkSize);
 };
 
 template<typename T>
@@ -75,6 +165,12 @@ void QQuerySet::addSelectRelated(const QForeignKey<T> &field)
     addSelectRelated_p(field);
 }
 
+template<typename T>
+void QQuerySet::addPrefetchRelated(const QReverseRelation<T> &relation, int chunkSize)
+{
+    addPrefetchRelated_p(relation.d, chunkSize);
+}
+
 template<typename T>
 void QQuerySet::addFields(const QForeignKey<T> &field)
 {
@@ -83,4 +179,7 @@ void QQuerySet::addFields(const QForeignKey<T> &field)
     addField(field);
 }
 
+// The awaiter returned by nextAsync()
+#include "qtormcoro.h"
+
 #endif
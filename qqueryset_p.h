@@ -0,0 +1,186 @@
+/*
+ * qqueryset_p.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QQUERYSETPRIVATE_H__
+#define __QQUERYSETPRIVATE_H__
+
+#include <QString>
+#include <QVector>
+#include <QList>
+#include <QStringList>
+#include <QSet>
+#include <QPair>
+#include <QHash>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QAtomicInt>
+
+#include "qfield.h"
+#include "qqueryset.h"
+#include "qwhere.h"
+#include "qtormstats.h"
+#include "qqueryplan.h"
+
+class QModel;
+class QForeignKeyPrivate;
+class QReverseRelationPrivate;
+class QtOrmSpan;
+
+class QQuerySetPrivate
+{
+    public:
+        QQuerySetPrivate(QModel *model);
+        ~QQuerySetPrivate();
+
+        // Held by QQuerySet and by the filters using it as a subquery
+        void ref();
+        bool deref();
+
+        void addSelectRelated(const QField &field);
+        void addPrefetchRelated(QReverseRelationPrivate *relation, int chunkSize);
+        void addFilter(const QWhere &cond);
+        void addOrderBy(const QField &field, bool asc);
+        void addField(const QField &field);
+        void addFields(QModel *model);
+        void excludeField(const QField &field);
+        void setLimit(int count);
+        void setOffset(int val);
+        void setDistinct(bool distinct);
+        void addDistinctOn(const QField &field);
+        void setLockMode(QQuerySet::LockMode mode);
+        void setLimitPerGroup(const QField &groupBy, int count);
+
+        bool next();
+        bool update(int *affectedRows);
+        bool remove(int *affectedRows);
+        int count();
+        bool claim();
+
+        void build(bool for_remove);
+        void buildStatement(bool for_remove);
+        void prepare();
+        bool exec();
+        QString sql() const;
+        void reset();
+
+        QSqlDatabase database();
+        void checkThreadDatabase();
+        void bindValues(QVariantList &values) const;
+        bool setUpFilters(const QSqlDatabase &db);
+        void tearDownFilters(const QSqlDatabase &db);
+        int columnCount() const;
+        void setBufferedRows(const QList<QVariantList> &rows, const QVariantList &values, qint64 execNsecs);
+        void finishStatement();
+        qint64 heapSize() const;
+
+        // Query plans, see qqueryplan.cpp
+        QQueryPlan explain();
+        void checkPlan();
+        static void setDevelopmentMode(bool enable, int largeTableRows);
+
+        static QString inlineValues(const QString &sql, const QVariantList &values, QSqlDriver *driver);   // Null if sql has a literal '?'
+
+        // Subqueries embedded in the filters of another queryset, see QFSubqueryWhere
+        QString subquerySql(QSqlDriver *driver);
+
+        // N+1 detection: queryset whose rows are being iterated in this thread
+        static QQuerySetPrivate *currentIteration();
+        static void setCurrentIteration(QQuerySetPrivate *queryset);
+        void foreignKeyQuery(const QForeignKeyPrivate *foreignKey);
+
+    private:
+        struct Join
+        {
+            QModel *model;
+            QForeignKeyPrivate *parent_foreignkey;
+            bool accepts_null;
+        };
+
+        bool buildJoins(QList<QQuerySetPrivate::Join> &joins, bool useSelectedFields);
+        QList<Join> buildSelectedFields(bool for_remove);
+        QString buildSelect(bool aliases);
+        bool hasDistinctOn() const;
+        bool numbersRows() const;
+        void appendJoinedFields(const QList<Join> &joins);
+        QString buildFrom(const QList<Join> &joins, bool for_remove);
+        QString buildWhere();
+        QString buildOrderBy();
+        QString buildLimit();
+        QString buildLock();
+        bool checkRowNumbers() const;
+        QString buildLimitPerGroup(const QList<Join> &joins);
+        QString buildSet(QVariantList &values, bool qualified) const;
+        bool usesJoins(const QString &sql, int tables) const;
+        bool fetchChunk();
+        void clearPrefetchRelated();
+
+    private:
+        QAtomicInt _refcount;
+        QSqlDatabase _db;
+        QSqlDriver *_driver;
+        QModel *_model;
+        int _limit, _offset;
+        int _first_table;           // Number of the main table, > 0 in subqueries
+        bool _built, _prepared, _executed;
+        bool _filters_set_up;       // The filters need tearDown() once the statement is finished
+        bool _holds_connection;     // The statement is being read, see QtOrmDatabase::holdConnection()
+        bool _thread_warned;        // checkThreadDatabase() already reported this queryset
+        QString _sql;
+        QStringList _tables;        // Names of the tables T0...Tn
+
+        QVector<QField> _selected_fields;
+        QSet<QField> _excluded_fields;
+        QSet<QModel *> _selected_models;
+        QVector<QField> _select_related;
+        QVector<QWhere> _filter;
+        QVector<QPair<QField, bool> > _order_by;
+        bool _distinct;
+        QVector<QField> _distinct_on;
+        QQuerySet::LockMode _lock_mode;
+        QField _group_field;
+        int _group_limit;           // Rows kept per value of _group_field, 0 for all
+
+        QSqlQuery _query;
+
+        // Statistics of the current execution, recorded when it is finished
+        bool _sample_pending;
+        QtOrmStatementSample _sample;
+        QVariantList _sample_values;    // Only kept for the slow query log
+        QString _stats_sql;
+        QtOrmSpan *_fetch_span;         // Only when tracing
+
+        // Foreign keys dereferenced while iterating, and how many queries they cost
+        QHash<const QForeignKeyPrivate *, int> _foreignkey_queries;
+
+        // Reverse relations loaded for chunks of rows, read ahead from _query
+        QVector<QReverseRelationPrivate *> _prefetch_related;
+        int _prefetch_chunk;
+        int _chunk_row;
+        QList<QVariantList> _chunk_rows;
+
+        // Rows fetched ahead of time (by QQueryBatch), used instead of _query
+        bool _buffered;
+        int _buffered_row;
+        QList<QVariantList> _buffered_rows;
+};
+
+#endif
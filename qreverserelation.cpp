@@ -0,0 +1,359 @@
+/*
+ * qreverserelation.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "qreverserelation.h"
+#include "qmodel.h"
+#include "qqueryset.h"
+#include "qqueryset_p.h"
+#include "qforeignkey_p.h"
+
+#include <QtDebug>
+
+QReverseRelationPrivate::QReverseRelationPrivate(QModel *model, const QString &foreignKey)
+ : _model(model),
+   _foreign_key(foreignKey),
+   _refcount(1)
+{
+}
+
+QReverseRelationPrivate::~QReverseRelationPrivate()
+{
+    clear();
+}
+
+QModel *QReverseRelationPrivate::model() const
+{
+    return _model;
+}
+
+QString QReverseRelationPrivate::foreignKey() const
+{
+    return _foreign_key;
+}
+
+void QReverseRelationPrivate::clear()
+{
+    QHash<QString, QList<QModel *> >::const_iterator it;
+
+    for (it = _children.constBegin(); it != _children.constEnd(); ++it)
+        qDeleteAll(it.value());
+
+    _children.clear();
+}
+
+void QReverseRelationPrivate::clear(const QVariant &key)
+{
+    qDeleteAll(_children.take(key.toString()));
+}
+
+QField QReverseRelationPrivate::findField(const QModel *model, const QString &name)
+{
+    for (int i=0; i<model->fieldsCount(); ++i)
+    {
+        if (model->field(i).name() == name)
+            return model->field(i);
+    }
+
+    qDebug() << "The model" << model->tableName() << "has no field named" << name;
+    return QField();
+}
+
+void QReverseRelationPrivate::copyFields(const QModel *from, QModel *to)
+{
+    for (int i=0; i<from->fieldsCount(); ++i)
+    {
+        QField field = to->field(i);
+
+        field.setRawData(from->field(i).data());
+    }
+
+    to->resetModified();
+}
+
+int QReverseRelationPrivate::insertedFieldsCount(const QModel *model)
+{
+    // saveBatch() inserts every field but a null primary key
+    int rs = 0;
+
+    for (int i=0; i<model->fieldsCount(); ++i)
+    {
+        if (!model->field(i).primaryKey() || !model->field(i).isNull())
+            rs++;
+    }
+
+    return rs;
+}
+
+const QList<QModel *> &QReverseRelationPrivate::children()
+{
+    QVariant key = _model->pk().data();
+
+    if (key.isNull())
+        return _no_children;
+
+    QHash<QString, QList<QModel *> >::const_iterator it = _children.constFind(key.toString());
+
+    if (it == _children.constEnd())
+    {
+        // Not prefetched, load the children of this row only
+        load(QVariantList() << key);
+        it = _children.constFind(key.toString());
+    }
+
+    if (it == _children.constEnd())
+        return _no_children;
+
+    return it.value();
+}
+
+void QReverseRelationPrivate::load(const QVariantList &keys)
+{
+    // The children of the previous rows are not reachable anymore
+    clear();
+
+    QModel *probe = createModel();
+    QField foreign_key = findField(probe, _foreign_key);
+
+    if (!foreign_key.isValid())
+    {
+        delete probe;
+        return;
+    }
+
+    // Parents without children get an empty list, and are not loaded again
+    for (int i=0; i<keys.count(); ++i)
+        _children.insert(keys.at(i).toString(), QList<QModel *>());
+
+    QQuerySetPrivate *iteration = QQuerySetPrivate::currentIteration();
+
+    {
+        QQuerySet query(probe);
+
+        query.addFilter(QF(foreign_key).in(keys));
+        query.addOrderBy(foreign_key, true);
+        query.addOrderBy(probe->pk(), true);
+
+        while (query.next())
+        {
+            QModel *child = createModel();
+
+            copyFields(probe, child);
+            _children[foreign_key.data().toString()].append(child);
+        }
+    }
+
+    // The query above is an iteration of its own
+    QQuerySetPrivate::setCurrentIteration(iteration);
+
+    delete probe;
+}
+
+void QReverseRelationPrivate::ref()
+{
+    _refcount.ref();
+}
+
+bool QReverseRelationPrivate::deref()
+{
+    return _refcount.deref();
+}
+
+/*
+ * QManyToManyPrivate
+ */
+
+// Values bound by one INSERT of links, SQLite binds at most 999 of them
+#define VALUES_PER_BATCH 999
+
+QManyToManyPrivate::QManyToManyPrivate(QModel *model, const QString &sourceKey, const QString &targetKey)
+ : QReverseRelationPrivate(model, sourceKey),
+   _target_key(targetKey),
+   _through(NULL)
+{
+}
+
+QManyToManyPrivate::~QManyToManyPrivate()
+{
+    delete _through;
+}
+
+QString QManyToManyPrivate::targetKey() const
+{
+    return _target_key;
+}
+
+QModel *QManyToManyPrivate::createThroughWithTarget(QField &sourceKey, QField &targetKey)
+{
+    QModel *rs = createThrough();
+
+    sourceKey = findField(rs, _foreign_key);
+    targetKey = findField(rs, _target_key);
+
+    if (!sourceKey.isValid() || !targetKey.isValid() || !targetKey.d->isForeignKey())
+    {
+        delete rs;
+        return NULL;
+    }
+
+    // Join the target model, that the through model will delete
+    ((QForeignKeyPrivate *)targetKey.d)->setValue(createModel());
+
+    return rs;
+}
+
+void QManyToManyPrivate::load(const QVariantList &keys)
+{
+    // The children of the previous rows are not reachable anymore
+    clear();
+
+    QField source_key, target_key;
+    QModel *probe = createThroughWithTarget(source_key, target_key);
+
+    if (!probe)
+        return;
+
+    QModel *target = ((QForeignKeyPrivate *)target_key.d)->value();
+
+    for (int i=0; i<keys.count(); ++i)
+        _children.insert(keys.at(i).toString(), QList<QModel *>());
+
+    QQuerySetPrivate *iteration = QQuerySetPrivate::currentIteration();
+
+    {
+        // The links and their targets, in one query joining the through model to the target
+        QQuerySet query(probe);
+
+        query.addField(source_key);
+        query.addFields(target);
+        query.addFilter(QF(source_key).in(keys));
+        query.addOrderBy(source_key, true);
+        query.addOrderBy(probe->pk(), true);
+
+        while (query.next())
+        {
+            QModel *child = createModel();
+
+            copyFields(target, child);
+            _children[source_key.data().toString()].append(child);
+        }
+    }
+
+    QQuerySetPrivate::setCurrentIteration(iteration);
+
+    delete probe;
+}
+
+QModel *QManyToManyPrivate::target()
+{
+    if (!_through)
+    {
+        QField source_key, target_key;
+
+        _through = createThroughWithTarget(source_key, target_key);
+
+        if (!_through)
+            return NULL;
+    }
+
+    return ((QForeignKeyPrivate *)findField(_through, _target_key).d)->value();
+}
+
+QWhere QManyToManyPrivate::contains(const QWhere &cond)
+{
+    // EXISTS (SELECT ... FROM through JOIN target WHERE through.source = T0.id AND cond)
+    if (!target())
+        return QWhere();
+
+    return QF(_model->pk()).exists(findField(_through, _foreign_key), cond);
+}
+
+bool QManyToManyPrivate::add(const QVariantList &targets)
+{
+    QVariant key = _model->pk().data();
+    bool rs = true;
+
+    if (key.isNull())
+    {
+        qDebug() << "Cannot add links to an unsaved" << _model->tableName();
+        return false;
+    }
+
+    for (int i=0; rs && i<targets.count(); )
+    {
+        // saveBatch() sets the primary key of the model, so a new one is used for each batch
+        QModel *through = createThrough();
+        QField source_key = findField(through, _foreign_key);
+        QField target_key = findField(through, _target_key);
+
+        if (!source_key.isValid() || !target_key.isValid())
+        {
+            delete through;
+            rs = false;
+            break;
+        }
+
+        int links = qMax(1, VALUES_PER_BATCH / qMax(1, insertedFieldsCount(through)));
+
+        for (int j=i; j<targets.count() && j<i + links; ++j)
+        {
+            source_key.setRawData(key);
+            target_key.setRawData(targets.at(j));
+            through->addInBatch();
+        }
+
+        rs = through->saveBatch();
+        i += links;
+        delete through;
+    }
+
+    clear(key);
+    return rs;
+}
+
+bool QManyToManyPrivate::remove(const QVariantList &targets)
+{
+    QVariant key = _model->pk().data();
+    bool rs = false;
+
+    if (key.isNull())
+        return false;
+
+    if (targets.isEmpty())
+        return true;
+
+    QModel *through = createThrough();
+    QField source_key = findField(through, _foreign_key);
+    QField target_key = findField(through, _target_key);
+
+    if (source_key.isValid() && target_key.isValid())
+    {
+        // One DELETE for all the links
+        QQuerySet query(through);
+
+        query.addFilter(QF(source_key) == key && QF(target_key).in(targets));
+        rs = query.remove();
+    }
+
+    delete through;
+    clear(key);
+    return rs;
+}
@@ -0,0 +1,202 @@
+/*
+ * qreverserelation.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QREVERSERELATION_H__
+#define __QREVERSERELATION_H__
+
+#include <QList>
+#include <QVariant>
+
+#include "qreverserelation_p.h"
+
+class QQuerySet;
+
+/**
+ * @brief Children of a model, through the foreign key they have to it
+ *
+ * Declared in the parent model with QModel::reverseRelation(). Each access
+ * runs one query for the current row of the parent, unless the relation was
+ * given to QQuerySet::addPrefetchRelated(), which loads the children of
+ * a whole chunk of parents at once.
+ */
+template<typename T>
+class QReverseRelation
+{
+    friend class QQuerySet;
+
+    public:
+        QReverseRelation();
+        QReverseRelation(QModel *model, const QString &foreignKey);
+        QReverseRelation(const QReverseRelation &other);
+        QReverseRelation &operator=(const QReverseRelation &other);
+        ~QReverseRelation();
+
+        int count() const;
+        bool isEmpty() const;
+        T *at(int i) const;         /*!< @brief Child model, owned by the relation until the next row of the parent */
+        QList<T *> all() const;
+
+    protected:
+        QReverseRelation(QReverseRelationPrivate *dptr);
+        QReverseRelationPrivate *d;
+};
+
+/**
+ * @brief Models T linked to a model by the rows of a through model
+ *
+ * Declared with QModel::manyToMany(). The children are the targets of the
+ * links, loaded and prefetched like those of a QReverseRelation.
+ */
+template<typename T>
+class QManyToMany : public QReverseRelation<T>
+{
+    friend class QModel;
+
+    public:
+        QManyToMany();
+
+        T *target() const;          /*!< @brief Model to use in the conditions given to contains() */
+        QWhere contains(const QWhere &cond = QWhere()) const;  /*!< @brief The model is linked to a target matching cond, with EXISTS */
+
+        bool add(const QVariantList &targets);      /*!< @brief Link the current row to the targets, in batched INSERTs, false on error */
+        bool remove(const QVariantList &targets);   /*!< @brief Unlink the current row from the targets, in one DELETE, false on error */
+
+    private:
+        QManyToMany(QManyToManyPrivate *dptr);
+        QManyToManyPrivate *dptr() const;
+};
+
+template<typename T>
+QReverseRelation<T>::QReverseRelation() : d(NULL)
+{
+}
+
+template<typename T>
+QReverseRelation<T>::QReverseRelation(QModel *model, const QString &foreignKey)
+: d(new QReverseRelationPrivateT<T>(model, foreignKey))
+{
+}
+
+template<typename T>
+QReverseRelation<T>::QReverseRelation(QReverseRelationPrivate *dptr) : d(dptr)
+{
+}
+
+template<typename T>
+QReverseRelation<T>::QReverseRelation(const QReverseRelation &other) : d(other.d)
+{
+    if (d)
+        d->ref();
+}
+
+template<typename T>
+QReverseRelation<T> &QReverseRelation<T>::operator=(const QReverseRelation &other)
+{
+    if (other.d)
+        other.d->ref();
+
+    if (d && !d->deref())
+        delete d;
+
+    d = other.d;
+
+    return *this;
+}
+
+template<typename T>
+QReverseRelation<T>::~QReverseRelation()
+{
+    if (d && !d->deref())
+        delete d;
+}
+
+template<typename T>
+int QReverseRelation<T>::count() const
+{
+    return d->children().count();
+}
+
+template<typename T>
+bool QReverseRelation<T>::isEmpty() const
+{
+    return d->children().isEmpty();
+}
+
+template<typename T>
+T *QReverseRelation<T>::at(int i) const
+{
+    return static_cast<T *>(d->children().at(i));
+}
+
+template<typename T>
+QList<T *> QReverseRelation<T>::all() const
+{
+    const QList<QModel *> &children = d->children();
+    QList<T *> rs;
+
+    for (int i=0; i<children.count(); ++i)
+        rs.append(static_cast<T *>(children.at(i)));
+
+    return rs;
+}
+
+template<typename T>
+QManyToMany<T>::QManyToMany()
+{
+}
+
+template<typename T>
+QManyToMany<T>::QManyToMany(QManyToManyPrivate *dptr) : QReverseRelation<T>(dptr)
+{
+}
+
+template<typename T>
+T *QManyToMany<T>::target() const
+{
+    return static_cast<T *>(dptr()->target());
+}
+
+template<typename T>
+QWhere QManyToMany<T>::contains(const QWhere &cond) const
+{
+    return dptr()->contains(cond);
+}
+
+template<typename T>
+bool QManyToMany<T>::add(const QVariantList &targets)
+{
+    return dptr()->add(targets);
+}
+
+template<typename T>
+bool QManyToMany<T>::remove(const QVariantList &targets)
+{
+    return dptr()->remove(targets);
+}
+
+template<typename T>
+QManyToManyPrivate *QManyToMany<T>::dptr() const
+{
+    return (QManyToManyPrivate *)this->d;
+}
+
+#endif
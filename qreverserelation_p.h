@@ -0,0 +1,138 @@
+/*
+ * qreverserelation_p.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QREVERSERELATIONPRIVATE_H__
+#define __QREVERSERELATIONPRIVATE_H__
+
+#include <QString>
+#include <QVariant>
+#include <QList>
+#include <QHash>
+#include <QAtomicInt>
+
+#include "qfield.h"
+#include "qwhere.h"
+
+class QModel;
+
+class QReverseRelationPrivate
+{
+    public:
+        QReverseRelationPrivate(QModel *model, const QString &foreignKey);
+        virtual ~QReverseRelationPrivate();
+
+        QModel *model() const;
+        QString foreignKey() const;
+
+        // Children of the current row of the model, loaded alone if needed
+        const QList<QModel *> &children();
+
+        // Children of several rows, in one query
+        virtual void load(const QVariantList &keys);
+        void clear();
+        void clear(const QVariant &key);
+
+        virtual QModel *createModel() const = 0;
+
+        void ref();
+        bool deref();
+
+    protected:
+        static QField findField(const QModel *model, const QString &name);
+        static void copyFields(const QModel *from, QModel *to);
+        static int insertedFieldsCount(const QModel *model);
+
+    protected:
+        QModel *_model;
+        QString _foreign_key;
+        QAtomicInt _refcount;
+
+        QHash<QString, QList<QModel *> > _children;    // Primary key of the parent, as a string
+        QList<QModel *> _no_children;
+};
+
+/*
+ * Many-to-many relations: the children are the targets of the rows of
+ * a through model, that has a foreign key to the model (_foreign_key) and
+ * one to the target (_target_key).
+ */
+class QManyToManyPrivate : public QReverseRelationPrivate
+{
+    public:
+        QManyToManyPrivate(QModel *model, const QString &sourceKey, const QString &targetKey);
+        ~QManyToManyPrivate();
+
+        QString targetKey() const;
+
+        void load(const QVariantList &keys);
+        QModel *target();
+        QWhere contains(const QWhere &cond);
+
+        bool add(const QVariantList &targets);
+        bool remove(const QVariantList &targets);
+
+        virtual QModel *createThrough() const = 0;
+
+    private:
+        QModel *createThroughWithTarget(QField &sourceKey, QField &targetKey);
+
+    private:
+        QString _target_key;
+        QModel *_through;       // Used by the filters, see target()
+};
+
+template<typename T>
+class QReverseRelationPrivateT : public QReverseRelationPrivate
+{
+    public:
+        QReverseRelationPrivateT(QModel *model, const QString &foreignKey)
+         : QReverseRelationPrivate(model, foreignKey)
+        {
+        }
+
+        QModel *createModel() const
+        {
+            return new T;
+        }
+};
+
+template<typename T, typename Through>
+class QManyToManyPrivateT : public QManyToManyPrivate
+{
+    public:
+        QManyToManyPrivateT(QModel *model, const QString &sourceKey, const QString &targetKey)
+         : QManyToManyPrivate(model, sourceKey, targetKey)
+        {
+        }
+
+        QModel *createModel() const
+        {
+            return new T;
+        }
+
+        QModel *createThrough() const
+        {
+            return new Through;
+        }
+};
+
+#endif
@@ -22,6 +22,7 @@
 
 #include "qstringfield.h"
 #include "qfield_p.h"
+#include "qtormfootprint_p.h"
 
 class QStringFieldPrivate : public QFieldPrivate
 {
@@ -35,6 +36,7 @@ class QStringFieldPrivate : public QFieldPrivate
         void fromData(const QVariant &data);
         QVariant data() const;
         QString sqlDescription() const;
+        qint64 heapSize() const;
 
     private:
         QString _data;
@@ -88,6 +90,11 @@ QString QStringFieldPrivate::sqlDescription() const
     return rs;
 }
 
+qint64 QStringFieldPrivate::heapSize() const
+{
+    return sizeof(*this) + commonHeapSize() + qtormHeapSize(_data);
+}
+
 /*
  * QStringField
  */
@@ -0,0 +1,103 @@
+/*
+ * qtormalloc.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "qtormalloc_p.h"
+
+bool QtOrmStats::hasAllocationStats()
+{
+#if defined(QTORM_ALLOC_STATS)
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char *QtOrmStats::allocationHook()
+{
+#if defined(QTORM_ALLOC_STATS)
+    return qtorm_alloc_hook();
+#elif defined(__GLIBC__)
+    return "malloc";
+#else
+    return "operator new";
+#endif
+}
+
+QtOrmStats::Allocations QtOrmStats::allocations(Operation operation)
+{
+    Allocations rs;
+
+#if defined(QTORM_ALLOC_STATS)
+    qtorm_alloc_read(operation, &rs.count, &rs.bytes);
+#else
+    Q_UNUSED(operation);
+
+    rs.count = 0;
+    rs.bytes = 0;
+#endif
+
+    return rs;
+}
+
+QtOrmStats::Allocations QtOrmStats::totalAllocations()
+{
+    Allocations rs;
+
+    rs.count = 0;
+    rs.bytes = 0;
+
+    for (int i=0; i<OperationCount; ++i)
+    {
+        Allocations op = allocations((Operation)i);
+
+        rs.count += op.count;
+        rs.bytes += op.bytes;
+    }
+
+    return rs;
+}
+
+const char *QtOrmStats::operationName(Operation operation)
+{
+    switch (operation)
+    {
+        case ExpressionOperation:
+            return "expression";
+        case BuildOperation:
+            return "build";
+        case BindOperation:
+            return "bind";
+        case HydrateOperation:
+            return "hydrate";
+        case SaveOperation:
+            return "save";
+        default:
+            return "other";
+    }
+}
+
+void QtOrmStats::resetAllocations()
+{
+#if defined(QTORM_ALLOC_STATS)
+    qtorm_alloc_reset();
+#endif
+}
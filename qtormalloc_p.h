@@ -0,0 +1,77 @@
+/*
+ * qtormalloc_p.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QTORMALLOC_P_H__
+#define __QTORMALLOC_P_H__
+
+#include "qtormstats.h"
+
+/*
+ * Allocation accounting. When QtORM is built with QTORM_ALLOC_STATS, the
+ * qtorm_allocstats library, preloaded with LD_PRELOAD, replaces the malloc
+ * family (only operator new outside of the GNU C library). It counts the
+ * allocations made inside a QTORM_ALLOC_SCOPE against the operation of the
+ * innermost scope of the current thread, and ignores the other ones.
+ * Otherwise, the scopes compile to nothing.
+ */
+
+#if defined(QTORM_ALLOC_STATS)
+
+// Operation of the allocations made outside of any scope, that are not counted
+#define QTORM_ALLOC_NO_OPERATION -1
+
+extern __thread int qtorm_alloc_operation __attribute__((tls_model("initial-exec")));
+
+extern "C"
+{
+    const char *qtorm_alloc_hook();
+    void qtorm_alloc_read(int operation, qint64 *count, qint64 *bytes);
+    void qtorm_alloc_reset();
+}
+
+class QtOrmAllocationScope
+{
+    public:
+        inline QtOrmAllocationScope(QtOrmStats::Operation operation)
+         : _previous(qtorm_alloc_operation)
+        {
+            qtorm_alloc_operation = operation;
+        }
+
+        inline ~QtOrmAllocationScope()
+        {
+            qtorm_alloc_operation = _previous;
+        }
+
+    private:
+        int _previous;
+};
+
+#define QTORM_ALLOC_SCOPE(operation) QtOrmAllocationScope _alloc_scope(QtOrmStats::operation)
+
+#else
+
+#define QTORM_ALLOC_SCOPE(operation)
+
+#endif
+
+#endif
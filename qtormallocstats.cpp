@@ -0,0 +1,328 @@
+/*
+ * qtormallocstats.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "qtormalloc_p.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <new>
+
+#if defined(QTORM_ALLOC_STATS)
+
+/*
+ * Allocation counting library, preloaded in the process to profile:
+ *
+ *     LD_PRELOAD=libqtorm_allocstats.so ./application
+ *
+ * Each thread counts into its own block of counters, so that counting never
+ * contends between threads. The blocks are folded together when the counters
+ * are read. The block of a thread that exits is folded into the retired
+ * counters, and reused by the next thread.
+ */
+
+struct CounterBlock
+{
+    qint64 counts[QtOrmStats::OperationCount];
+    qint64 bytes[QtOrmStats::OperationCount];
+    qint64 reset_counts[QtOrmStats::OperationCount];    // Values at the last reset, or when the thread exited
+    qint64 reset_bytes[QtOrmStats::OperationCount];
+    bool used;
+    CounterBlock *next;
+};
+
+// Initial-exec, so that reading them never allocates (and recurses into malloc)
+__thread int qtorm_alloc_operation __attribute__((tls_model("initial-exec"))) = QTORM_ALLOC_NO_OPERATION;
+static __thread CounterBlock *thread_block __attribute__((tls_model("initial-exec"))) = NULL;
+static __thread bool registering __attribute__((tls_model("initial-exec"))) = false;
+
+// The blocks are never freed. The mutex is not taken when counting.
+static pthread_mutex_t blocks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static CounterBlock *blocks = NULL;
+static qint64 retired_counts[QtOrmStats::OperationCount];
+static qint64 retired_bytes[QtOrmStats::OperationCount];
+
+static pthread_key_t block_key;
+static pthread_once_t block_key_once = PTHREAD_ONCE_INIT;
+
+// Set by the first allocation that goes through this library
+static int interposed = 0;
+
+#if defined(__GLIBC__)
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void __libc_free(void *ptr);
+}
+
+#define RAW_CALLOC __libc_calloc
+#else
+#define RAW_CALLOC calloc
+#endif
+
+static inline qint64 load(const qint64 &counter)
+{
+    return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+
+static void retireBlock(void *data)
+{
+    CounterBlock *block = (CounterBlock *)data;
+
+    pthread_mutex_lock(&blocks_mutex);
+
+    for (int i=0; i<QtOrmStats::OperationCount; ++i)
+    {
+        retired_counts[i] += load(block->counts[i]) - block->reset_counts[i];
+        retired_bytes[i] += load(block->bytes[i]) - block->reset_bytes[i];
+        block->reset_counts[i] = load(block->counts[i]);
+        block->reset_bytes[i] = load(block->bytes[i]);
+    }
+
+    block->used = false;
+    thread_block = NULL;
+
+    pthread_mutex_unlock(&blocks_mutex);
+}
+
+static void createBlockKey()
+{
+    pthread_key_create(&block_key, retireBlock);
+}
+
+static CounterBlock *threadBlock()
+{
+    if (thread_block)
+        return thread_block;
+
+    // Allocations made while registering the thread are not counted
+    if (registering)
+        return NULL;
+
+    registering = true;
+    pthread_once(&block_key_once, createBlockKey);
+    pthread_mutex_lock(&blocks_mutex);
+
+    CounterBlock *block = blocks;
+
+    while (block && block->used)
+        block = block->next;
+
+    if (!block)
+    {
+        block = (CounterBlock *)RAW_CALLOC(1, sizeof(CounterBlock));
+
+        if (block)
+        {
+            block->next = blocks;
+            blocks = block;
+        }
+    }
+
+    if (block)
+        block->used = true;
+
+    pthread_mutex_unlock(&blocks_mutex);
+
+    if (block)
+        pthread_setspecific(block_key, block);
+
+    thread_block = block;
+    registering = false;
+
+    return block;
+}
+
+static inline void countAlloc(size_t size)
+{
+    int operation = qtorm_alloc_operation;
+
+    if (!__atomic_load_n(&interposed, __ATOMIC_RELAXED))
+        __atomic_store_n(&interposed, 1, __ATOMIC_RELAXED);
+
+    // Allocations of the application, not made by a QtORM statement
+    if (operation == QTORM_ALLOC_NO_OPERATION)
+        return;
+
+    CounterBlock *block = threadBlock();
+
+    if (!block)
+        return;
+
+    // Only this thread writes to its block, the readers load the counters
+    __atomic_store_n(&block->counts[operation], block->counts[operation] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&block->bytes[operation], block->bytes[operation] + qint64(size), __ATOMIC_RELAXED);
+}
+
+extern "C"
+{
+
+const char *qtorm_alloc_hook()
+{
+    if (!__atomic_load_n(&interposed, __ATOMIC_RELAXED))
+        return "none";
+
+#if defined(__GLIBC__)
+    return "malloc";
+#else
+    return "operator new";
+#endif
+}
+
+void qtorm_alloc_read(int operation, qint64 *count, qint64 *bytes)
+{
+    pthread_mutex_lock(&blocks_mutex);
+
+    *count = retired_counts[operation];
+    *bytes = retired_bytes[operation];
+
+    for (CounterBlock *block = blocks; block; block = block->next)
+    {
+        *count += load(block->counts[operation]) - block->reset_counts[operation];
+        *bytes += load(block->bytes[operation]) - block->reset_bytes[operation];
+    }
+
+    pthread_mutex_unlock(&blocks_mutex);
+}
+
+void qtorm_alloc_reset()
+{
+    pthread_mutex_lock(&blocks_mutex);
+
+    for (int i=0; i<QtOrmStats::OperationCount; ++i)
+    {
+        retired_counts[i] = 0;
+        retired_bytes[i] = 0;
+
+        for (CounterBlock *block = blocks; block; block = block->next)
+        {
+            block->reset_counts[i] = load(block->counts[i]);
+            block->reset_bytes[i] = load(block->bytes[i]);
+        }
+    }
+
+    pthread_mutex_unlock(&blocks_mutex);
+}
+
+}
+
+#if defined(__GLIBC__)
+
+/*
+ * The containers of Qt 4 (QString, QByteArray, QVector, QHash...) allocate
+ * with qMalloc() and qRealloc(), that call malloc() and realloc(), and so
+ * does operator new. The malloc family is replaced, and forwards to the
+ * allocator of the GNU C library.
+ */
+
+extern "C"
+{
+
+void *malloc(size_t size)
+{
+    countAlloc(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    // An overflowing size makes __libc_calloc() fail, it is not counted
+    if (size == 0 || count <= size_t(-1) / size)
+        countAlloc(count * size);
+
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    countAlloc(size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+}
+
+#else
+
+/*
+ * Elsewhere, only operator new can be replaced portably: the allocations of
+ * the Qt containers, made with qMalloc(), are not counted.
+ */
+
+#if __cplusplus >= 201103L
+#define THROW_BAD_ALLOC
+#else
+#define THROW_BAD_ALLOC throw(std::bad_alloc)
+#endif
+
+static inline void *countedAlloc(size_t size)
+{
+    void *rs = malloc(size ? size : 1);
+
+    if (!rs)
+        throw std::bad_alloc();
+
+    countAlloc(size);
+
+    return rs;
+}
+
+void *operator new(size_t size) THROW_BAD_ALLOC
+{
+    return countedAlloc(size);
+}
+
+void *operator new[](size_t size) THROW_BAD_ALLOC
+{
+    return countedAlloc(size);
+}
+
+void operator delete(void *ptr) throw()
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) throw()
+{
+    free(ptr);
+}
+
+#if defined(__cpp_sized_deallocation)
+void operator delete(void *ptr, size_t) throw()
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) throw()
+{
+    free(ptr);
+}
+#endif
+
+#endif
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * qtormcoro.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QTORMCORO_H__
+#define __QTORMCORO_H__
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <coroutine>
+#include <utility>
+
+#include "qqueryset.h"
+#include "qtormexecutor.h"
+
+/**
+ * @brief Awaitable running QQuerySet::next() in a thread of a QtOrmExecutor
+ *
+ * The coroutine is resumed in that thread, after the model has been populated.
+ * A queryset always runs in the same thread, whose connection it uses.
+ */
+class QQuerySetNextAwaiter : public QtOrmExecutor::Job
+{
+    public:
+        QQuerySetNextAwaiter(QQuerySet *querySet, QtOrmExecutor *executor)
+        : _queryset(querySet), _executor(executor), _result(false)
+        {
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            _handle = handle;
+            _executor->post(this, qHash(_queryset));
+        }
+
+        bool await_resume() const noexcept
+        {
+            return _result;
+        }
+
+        void run()
+        {
+            std::coroutine_handle<> handle = _handle;
+
+            _queryset->checkThreadDatabase();
+            _result = _queryset->next();
+            handle.resume();    // May destroy this awaiter
+        }
+
+    private:
+        QQuerySet *_queryset;
+        QtOrmExecutor *_executor;
+        std::coroutine_handle<> _handle;
+        bool _result;
+};
+
+inline QQuerySetNextAwaiter QQuerySet::nextAsync(QtOrmExecutor *executor)
+{
+    return QQuerySetNextAwaiter(this, executor ? executor : QtOrmExecutor::globalInstance());
+}
+
+/**
+ * @brief Awaitable running any function in a thread of a QtOrmExecutor
+ *
+ * Use it for blocking work other than iterating a queryset, for instance
+ * co_await qtormAsync([&] { model.save(); });
+ */
+template<typename F>
+class QtOrmCallAwaiter : public QtOrmExecutor::Job
+{
+    public:
+        QtOrmCallAwaiter(F func, QtOrmExecutor *executor)
+        : _func(std::move(func)), _executor(executor)
+        {
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            _handle = handle;
+            _executor->post(this);
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+
+        void run()
+        {
+            std::coroutine_handle<> handle = _handle;
+
+            _func();
+            handle.resume();    // May destroy this awaiter
+        }
+
+    private:
+        F _func;
+        QtOrmExecutor *_executor;
+        std::coroutine_handle<> _handle;
+};
+
+template<typename F>
+QtOrmCallAwaiter<F> qtormAsync(F func, QtOrmExecutor *executor = 0)
+{
+    return QtOrmCallAwaiter<F>(std::move(func), executor ? executor : QtOrmExecutor::globalInstance());
+}
+
+#endif
+
+#endif
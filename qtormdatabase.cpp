@@ -1,19 +1,129 @@
 #include "qtormdatabase.h"
+#include "qmodel.h"
+#include "qqueryset.h"
+#include "qtormalloc_p.h"
+
+#include <QtSql>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include <QDateTime>
+#include <QThread>
+#include <QtDebug>
+
+struct ThreadConnection
+{
+    QSqlDatabase db;
+    QHash<QString, QSqlQuery> statements;
+
+    // State of the connections used by this thread that a retry or a
+    // reconnection would lose, by driver
+    QHash<const QSqlDriver *, int> transactions;
+    QHash<const QSqlDriver *, int> holds;
+
+    // Features of the server, asked once per connection
+    QHash<const QSqlDriver *, bool> window_functions;
+};
 
 static bool per_thread_database = false;
 static QtOrmDatabase::CreatorFunc creator_func = NULL;
+static int statement_cache_size = 64;
+
+// Statements prepared on every new connection, see warmUp()
+static QMutex registry_mutex;
+static QStringList registered_statements;
+
+static __thread ThreadConnection *thread_connection = NULL;
+
+// Retry of transient errors
+static QMutex retry_mutex;
+static QtOrmDatabase::RetryPolicy retry_policy;
+static QAtomicInt retry_count, reconnect_count, failure_count;
+static __thread bool random_seeded = false;
+
+class SleepThread : public QThread
+{
+    public:
+        static void msleep(unsigned long msecs)
+        {
+            QThread::msleep(msecs);
+        }
+};
+
+static void prepareRegistered(ThreadConnection *conn, QtOrmDatabase::WarmUpReport &report)
+{
+    QStringList statements;
+
+    {
+        QMutexLocker locker(&registry_mutex);
+        statements = registered_statements;
+    }
+
+    // Prepare the statements on this connection, they will be taken by
+    // the querysets and models that use them
+    for (int i=0; i<statements.count(); ++i)
+    {
+        if (conn->statements.contains(statements.at(i)))
+            continue;
+
+        QSqlQuery query(conn->db);
+
+        if (!query.prepare(statements.at(i)))
+        {
+            report.failures++;
+            continue;
+        }
+
+        conn->statements.insert(statements.at(i), query);
+        report.statements++;
+    }
+}
+
+static ThreadConnection *threadConnection(bool prepare = true)
+{
+    if (!thread_connection)
+    {
+        thread_connection = new ThreadConnection;
 
-__thread QSqlDatabase *thread_database = NULL;
+        if (per_thread_database)
+        {
+            // Connections are opened by the thread that uses them, as Qt
+            // requires. warmUp() prepares the statements itself, to time it.
+            thread_connection->db = creator_func();
+
+            if (prepare && thread_connection->db.isOpen())
+            {
+                QtOrmDatabase::WarmUpReport report;
+
+                prepareRegistered(thread_connection, report);
+            }
+        }
+    }
+
+    if (!per_thread_database)
+    {
+        // The statements are cached for the default connection of this thread
+        QSqlDatabase db = QSqlDatabase::database();
+
+        if (db.driver() != thread_connection->db.driver())
+            thread_connection->statements.clear();
+
+        thread_connection->db = db;
+    }
+
+    return thread_connection;
+}
 
 QSqlDatabase QtOrmDatabase::threadDatabase()
 {
     // One database per thread, to avoid conflicts between threads and thread-non-safety of QtSql
     if (per_thread_database)
     {
-        if (!thread_database)
-            thread_database = new QSqlDatabase(creator_func());
-
-        return *thread_database;
+        return threadConnection()->db;
     }
     else
     {
@@ -26,20 +136,426 @@ void QtOrmDatabase::setPerThreadDatabase(bool enable)
     per_thread_database = enable;
 }
 
+bool QtOrmDatabase::perThreadDatabase()
+{
+    return per_thread_database;
+}
+
 void QtOrmDatabase::setThreadDatabase(QSqlDatabase db)
 {
-    if (thread_database)
-        delete thread_database;
+    if (thread_connection)
+        delete thread_connection;
 
-    thread_database = new QSqlDatabase(db);
+    thread_connection = new ThreadConnection;
+    thread_connection->db = db;
 }
 
 bool QtOrmDatabase::threadHasDatabase()
 {
-    return (!per_thread_database || thread_database != NULL);
+    return (!per_thread_database || thread_connection != NULL);
 }
 
 void QtOrmDatabase::setDatabaseCreator(QtOrmDatabase::CreatorFunc func)
 {
     creator_func = func;
 }
+
+QSqlQuery QtOrmDatabase::takePreparedQuery(const QSqlDatabase &db, const QString &sql, bool *ok)
+{
+    ThreadConnection *conn = threadConnection();
+
+    // Reuse a statement already prepared on this connection
+    if (conn->db.driver() == db.driver())
+    {
+        QHash<QString, QSqlQuery>::iterator it = conn->statements.find(sql);
+
+        if (it != conn->statements.end())
+        {
+            QSqlQuery rs = it.value();
+
+            conn->statements.erase(it);
+
+            if (ok)
+                *ok = true;
+
+            return rs;
+        }
+    }
+
+    QSqlQuery rs(db);
+    bool prepared = rs.prepare(sql);
+
+    if (ok)
+        *ok = prepared;
+
+    return rs;
+}
+
+void QtOrmDatabase::recycleQuery(QSqlQuery query)
+{
+    ThreadConnection *conn = threadConnection();
+
+    // Only keep statements prepared on the connection of this thread
+    if (query.driver() != conn->db.driver() || query.lastQuery().isEmpty())
+        return;
+
+    if (conn->statements.count() >= statement_cache_size || conn->statements.contains(query.lastQuery()))
+        return;
+
+    query.finish();
+    conn->statements.insert(query.lastQuery(), query);
+}
+
+void QtOrmDatabase::setStatementCacheSize(int size)
+{
+    statement_cache_size = size;
+}
+
+void QtOrmDatabase::registerStatement(const QString &sql)
+{
+    QMutexLocker locker(&registry_mutex);
+
+    if (!registered_statements.contains(sql))
+        registered_statements.append(sql);
+}
+
+void QtOrmDatabase::registerStatements(QModel *model)
+{
+    QSqlDriver *driver = threadDatabase().driver();
+
+    // The UPDATE of save() only sets the modified fields, its shape is not known in advance
+    registerStatement(model->insertSql(driver, 1, true));
+    registerStatement(model->removeSql(driver));
+}
+
+void QtOrmDatabase::registerStatements(QQuerySet *querySet)
+{
+    registerStatement(querySet->sql());
+}
+
+QtOrmDatabase::WarmUpReport::WarmUpReport()
+ : connections(0),
+   statements(0),
+   failures(0),
+   connectNsecs(0),
+   prepareNsecs(0)
+{
+}
+
+QtOrmDatabase::WarmUpReport QtOrmDatabase::warmUp()
+{
+    WarmUpReport report;
+    QElapsedTimer timer;
+
+    // The connection of this thread, opened here if it is not yet
+    timer.start();
+
+    bool opened = (per_thread_database && thread_connection == NULL);
+    ThreadConnection *conn = threadConnection(false);
+
+    if (!conn->db.isOpen())
+    {
+        if (!conn->db.open())
+        {
+            report.failures++;
+            return report;
+        }
+
+        opened = true;
+    }
+
+    report.connectNsecs = timer.nsecsElapsed();
+    report.connections = (opened ? 1 : 0);
+    timer.restart();
+
+    prepareRegistered(conn, report);
+
+    report.prepareNsecs = timer.nsecsElapsed();
+
+    return report;
+}
+
+QtOrmDatabase::RetryPolicy::RetryPolicy()
+ : maxAttempts(1),
+   baseDelayMsecs(10),
+   maxDelayMsecs(1000),
+   retriableErrors(ConnectionErrors | BusyErrors),
+   retryWrites(false)
+{
+}
+
+void QtOrmDatabase::setRetryPolicy(const RetryPolicy &policy)
+{
+    QMutexLocker locker(&retry_mutex);
+
+    retry_policy = policy;
+}
+
+QtOrmDatabase::RetryPolicy QtOrmDatabase::retryPolicy()
+{
+    QMutexLocker locker(&retry_mutex);
+
+    return retry_policy;
+}
+
+QtOrmDatabase::RetryStats QtOrmDatabase::retryStats()
+{
+    RetryStats rs;
+
+    rs.retries = retry_count;
+    rs.reconnects = reconnect_count;
+    rs.failures = failure_count;
+
+    return rs;
+}
+
+void QtOrmDatabase::resetRetryStats()
+{
+    retry_count = 0;
+    reconnect_count = 0;
+    failure_count = 0;
+}
+
+int QtOrmDatabase::errorClass(const QSqlDatabase &db, const QSqlError &error)
+{
+    QString driver = db.driverName();
+    QString text = error.databaseText();
+    int number = error.number();
+
+    if (error.type() == QSqlError::ConnectionError || !db.isOpen())
+        return ConnectionErrors;
+
+    if (driver.startsWith(QLatin1String("QSQLITE")))
+    {
+        // SQLITE_BUSY and SQLITE_LOCKED
+        if (number == 5 || number == 6)
+            return BusyErrors;
+    }
+    else if (driver.startsWith(QLatin1String("QMYSQL")))
+    {
+        // Server gone away, lost connection, lock wait timeout and deadlock
+        if (number == 2006 || number == 2013)
+            return ConnectionErrors;
+        if (number == 1205)
+            return BusyErrors;
+        if (number == 1213)
+            return TransactionErrors;
+    }
+    else if (driver.startsWith(QLatin1String("QPSQL")))
+    {
+        // The PostgreSQL driver does not give SQLSTATEs, look at the message
+        if (text.contains(QLatin1String("server closed the connection")) ||
+            text.contains(QLatin1String("terminating connection")))
+            return ConnectionErrors;
+        if (text.contains(QLatin1String("deadlock detected")) ||
+            text.contains(QLatin1String("could not serialize access")))
+            return TransactionErrors;
+    }
+
+    if (error.type() == QSqlError::TransactionError)
+        return TransactionErrors;
+
+    return 0;
+}
+
+bool QtOrmDatabase::transaction(const QSqlDatabase &db)
+{
+    QSqlDatabase conn_db(db);
+
+    if (!conn_db.transaction())
+        return false;
+
+    threadConnection()->transactions[db.driver()]++;
+    return true;
+}
+
+bool QtOrmDatabase::commit(const QSqlDatabase &db)
+{
+    QSqlDatabase conn_db(db);
+    int &transactions = threadConnection()->transactions[db.driver()];
+
+    // Even a failed COMMIT ends the transaction
+    if (transactions > 0)
+        transactions--;
+
+    return conn_db.commit();
+}
+
+bool QtOrmDatabase::rollback(const QSqlDatabase &db)
+{
+    QSqlDatabase conn_db(db);
+    int &transactions = threadConnection()->transactions[db.driver()];
+
+    if (transactions > 0)
+        transactions--;
+
+    return conn_db.rollback();
+}
+
+bool QtOrmDatabase::inTransaction(const QSqlDatabase &db)
+{
+    return threadConnection()->transactions.value(db.driver()) > 0;
+}
+
+bool QtOrmDatabase::hasWindowFunctions(const QSqlDatabase &db)
+{
+    QHash<const QSqlDriver *, bool> &cache = threadConnection()->window_functions;
+    QHash<const QSqlDriver *, bool>::const_iterator it = cache.constFind(db.driver());
+
+    if (it != cache.constEnd())
+        return it.value();
+
+    // PostgreSQL has them since 8.4, SQLite since 3.25, MySQL since 8.0 and MariaDB since 10.2
+    QString driver = db.driverName();
+    QSqlQuery query(db);
+    bool rs = true;
+
+    if (driver.startsWith(QLatin1String("QSQLITE")) || driver.startsWith(QLatin1String("QMYSQL")))
+    {
+        bool sqlite = driver.startsWith(QLatin1String("QSQLITE"));
+
+        if (query.exec(QLatin1String(sqlite ? "SELECT sqlite_version()" : "SELECT VERSION()")) && query.next())
+        {
+            QString version = query.value(0).toString();
+            QStringList parts = version.split(QLatin1Char('.'));
+            int major = parts.value(0).toInt();
+            int minor = parts.value(1).toInt();
+
+            if (sqlite)
+                rs = (major > 3 || (major == 3 && minor >= 25));
+            else if (version.contains(QLatin1String("MariaDB")))
+                rs = (major > 10 || (major == 10 && minor >= 2));
+            else
+                rs = (major >= 8);
+        }
+    }
+
+    cache.insert(db.driver(), rs);
+
+    return rs;
+}
+
+void QtOrmDatabase::holdConnection(const QSqlDatabase &db)
+{
+    threadConnection()->holds[db.driver()]++;
+}
+
+void QtOrmDatabase::releaseConnection(const QSqlDatabase &db)
+{
+    int &holds = threadConnection()->holds[db.driver()];
+
+    if (holds > 0)
+        holds--;
+}
+
+static bool isSelect(const QString &sql)
+{
+    return sql.trimmed().startsWith(QLatin1String("SELECT"), Qt::CaseInsensitive);
+}
+
+static void reconnect(QSqlQuery &query, const QSqlDatabase &db)
+{
+    QSqlDatabase conn_db(db);
+    QString sql = query.lastQuery();
+
+    conn_db.close();
+
+    if (!conn_db.open())
+        return;
+
+    reconnect_count.ref();
+
+    // The statements prepared on the old connection are gone, prepare them again
+    ThreadConnection *conn = threadConnection();
+
+    if (conn->db.driver() == db.driver())
+    {
+        QStringList cached = conn->statements.keys();
+
+        conn->statements.clear();
+
+        for (int i=0; i<cached.count(); ++i)
+        {
+            QSqlQuery cached_query(conn_db);
+
+            if (cached_query.prepare(cached.at(i)))
+                conn->statements.insert(cached.at(i), cached_query);
+        }
+    }
+
+    query = QSqlQuery(conn_db);
+    query.prepare(sql);
+}
+
+bool QtOrmDatabase::execQuery(QSqlQuery &query, const QSqlDatabase &db, const QVariantList &values)
+{
+    QTORM_ALLOC_SCOPE(OtherOperation);
+
+    // The policy is only read once a statement has failed
+    RetryPolicy policy;
+    int delay = 0;
+
+    for (int attempt = 1; ; ++attempt)
+    {
+        {
+            QTORM_ALLOC_SCOPE(BindOperation);
+
+            for (int i=0; i<values.count(); ++i)
+            {
+                query.addBindValue(values.at(i));
+            }
+        }
+
+        if (query.exec())
+            return true;
+
+        if (attempt == 1)
+        {
+            policy = retryPolicy();
+            delay = policy.baseDelayMsecs;
+        }
+
+        int error_class = errorClass(db, query.lastError());
+        bool retriable = (error_class & policy.retriableErrors) != 0;
+
+        // A write whose connection was lost may have been committed before the
+        // error, running it again could insert or update its rows twice
+        if (retriable && !policy.retryWrites && !isSelect(query.lastQuery()))
+            retriable = false;
+
+        // Retrying a statement of a transaction would run it alone, after the
+        // transaction was rolled back. Reconnecting would lose the temporary
+        // tables and the rows of the statements being read.
+        if (retriable && inTransaction(db))
+            retriable = false;
+
+        if (retriable && error_class == ConnectionErrors && threadConnection()->holds.value(db.driver()) > 0)
+            retriable = false;
+
+        if (attempt >= policy.maxAttempts || !retriable)
+        {
+            if (attempt > 1)
+                failure_count.ref();
+
+            return false;
+        }
+
+        qDebug() << "Retrying the query \"" << query.lastQuery() << "\" after :" << query.lastError();
+        retry_count.ref();
+
+        // Exponential backoff, with a jitter so that contending threads don't retry together
+        if (!random_seeded)
+        {
+            qsrand(uint(QDateTime::currentMSecsSinceEpoch()) ^ uint(quintptr(&random_seeded)));
+            random_seeded = true;
+        }
+
+        if (delay > 0)
+            SleepThread::msleep(delay / 2 + qrand() % (delay / 2 + 1));
+
+        delay = qMin(delay * 2, policy.maxDelayMsecs);
+
+        if (error_class == ConnectionErrors)
+            reconnect(query, db);
+    }
+}
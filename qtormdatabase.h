@@ -2,6 +2,12 @@
 #define __QTORMDATABASE_H__
 
 #include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QString>
+#include <QVariant>
+
+class QModel;
+class QQuerySet;
 
 class QtOrmDatabase
 {
@@ -11,9 +17,86 @@ class QtOrmDatabase
         typedef QSqlDatabase (*CreatorFunc)();
 
         static void setPerThreadDatabase(bool enable);
+        static bool perThreadDatabase();
         static bool threadHasDatabase();
         static void setThreadDatabase(QSqlDatabase db);
         static void setDatabaseCreator(CreatorFunc func);
+
+        // Prepared statements, cached per thread and per connection
+        static QSqlQuery takePreparedQuery(const QSqlDatabase &db, const QString &sql, bool *ok = 0);
+        static void recycleQuery(QSqlQuery query);
+        static void setStatementCacheSize(int size);
+
+        // Warm-up
+        struct WarmUpReport
+        {
+            WarmUpReport();
+
+            int connections;        /*!< @brief Connections opened, 0 or 1 as warm-up is per thread */
+            int statements;         /*!< @brief Registered statements prepared on the connection, not those it already had */
+            int failures;           /*!< @brief Connections or statements that could not be opened or prepared */
+            qint64 connectNsecs;
+            qint64 prepareNsecs;
+        };
+
+        static void registerStatement(const QString &sql);
+        static void registerStatements(QModel *model);
+        static void registerStatements(QQuerySet *querySet);
+
+        /**
+         * @brief Open the connection of the calling thread and prepare the registered statements
+         *
+         * Connections are only used by the thread that opened them. With
+         * per-thread databases, the connections opened later by
+         * threadDatabase() also prepare the registered statements.
+         */
+        static WarmUpReport warmUp();
+
+        // Retry of transient errors
+        enum ErrorClass
+        {
+            ConnectionErrors = 0x1,     /*!< @brief The connection is lost, it is reopened before retrying */
+            BusyErrors = 0x2,           /*!< @brief The database is locked by another connection (SQLITE_BUSY, SQLITE_LOCKED, lock wait timeouts) */
+            TransactionErrors = 0x4     /*!< @brief Deadlocks and serialization failures */
+        };
+
+        struct RetryPolicy
+        {
+            RetryPolicy();
+
+            int maxAttempts;            /*!< @brief Number of executions of a statement, 1 disables retrying */
+            int baseDelayMsecs;         /*!< @brief Delay before the first retry, doubled at each attempt */
+            int maxDelayMsecs;
+            int retriableErrors;        /*!< @brief Combination of ErrorClass values */
+            bool retryWrites;           /*!< @brief Also retry INSERT, UPDATE and DELETE statements, which may run twice */
+        };
+
+        struct RetryStats
+        {
+            int retries;                /*!< @brief Executions that were retried */
+            int reconnects;
+            int failures;               /*!< @brief Statements that still failed after the last attempt */
+        };
+
+        static void setRetryPolicy(const RetryPolicy &policy);
+        static RetryPolicy retryPolicy();
+        static RetryStats retryStats();
+        static void resetRetryStats();
+
+        // Transactions, to be opened with these functions so that their statements are not retried
+        static bool transaction(const QSqlDatabase &db = threadDatabase());
+        static bool commit(const QSqlDatabase &db = threadDatabase());
+        static bool rollback(const QSqlDatabase &db = threadDatabase());
+        static bool inTransaction(const QSqlDatabase &db = threadDatabase());
+
+        // State of a connection that a reconnection would lose (temporary tables, statements being read)
+        static void holdConnection(const QSqlDatabase &db);
+        static void releaseConnection(const QSqlDatabase &db);
+
+        static bool hasWindowFunctions(const QSqlDatabase &db = threadDatabase());   /*!< @brief ROW_NUMBER() OVER (...), asked once per connection */
+
+        static int errorClass(const QSqlDatabase &db, const QSqlError &error);
+        static bool execQuery(QSqlQuery &query, const QSqlDatabase &db, const QVariantList &values);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,56 @@
+/*
+ * qtormdiagnostics.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "qtormdiagnostics.h"
+
+#include <QtDebug>
+
+static int n_plus_one_threshold = -1;
+static QtOrmDiagnostics::NPlusOneHandler n_plus_one_handler = NULL;
+
+void QtOrmDiagnostics::setNPlusOneThreshold(int queries)
+{
+    n_plus_one_threshold = queries;
+}
+
+int QtOrmDiagnostics::nPlusOneThreshold()
+{
+    return n_plus_one_threshold;
+}
+
+void QtOrmDiagnostics::setNPlusOneHandler(NPlusOneHandler handler)
+{
+    n_plus_one_handler = handler;
+}
+
+void QtOrmDiagnostics::abortOnNPlusOne(const QString &message)
+{
+    qFatal("%s", qPrintable(message));
+}
+
+void QtOrmDiagnostics::reportNPlusOne(const QString &message)
+{
+    if (n_plus_one_handler)
+        n_plus_one_handler(message);
+    else
+        qDebug() << message;
+}
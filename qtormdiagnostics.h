@@ -0,0 +1,58 @@
+/*
+ * qtormdiagnostics.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QTORMDIAGNOSTICS_H__
+#define __QTORMDIAGNOSTICS_H__
+
+#include <QString>
+
+/**
+ * @brief Detection of N+1 queries
+ *
+ * Dereferencing a foreign key that was not selected with addSelectRelated()
+ * runs a query to fetch the target model. Doing that in a loop over
+ * QQuerySet::next() runs one query per row. When the detection is enabled,
+ * these queries are counted per queryset and per foreign key, and the
+ * handler is called once when their number exceeds the threshold.
+ *
+ * The detection is disabled by default (the threshold is -1).
+ */
+class QtOrmDiagnostics
+{
+    public:
+        typedef void (*NPlusOneHandler)(const QString &message);
+
+        static void setNPlusOneThreshold(int queries);
+        static int nPlusOneThreshold();
+
+        /**
+         * @brief Handler called when N+1 queries are detected, qDebug() if NULL
+         *
+         * Use abortOnNPlusOne() to make tests fail.
+         */
+        static void setNPlusOneHandler(NPlusOneHandler handler);
+        static void abortOnNPlusOne(const QString &message);
+
+        static void reportNPlusOne(const QString &message);
+};
+
+#endif
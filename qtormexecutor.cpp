@@ -0,0 +1,162 @@
+/*
+ * qtormexecutor.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "qtormexecutor.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QVector>
+#include <QAtomicInt>
+
+class QtOrmExecutorThread : public QThread
+{
+    public:
+        QtOrmExecutorThread();
+
+        void post(QtOrmExecutor::Job *job);
+        void stop();
+
+    protected:
+        void run();
+
+    private:
+        QMutex _mutex;
+        QWaitCondition _cond;
+        QQueue<QtOrmExecutor::Job *> _jobs;
+        bool _stopping;
+};
+
+QtOrmExecutorThread::QtOrmExecutorThread()
+: _stopping(false)
+{
+}
+
+void QtOrmExecutorThread::post(QtOrmExecutor::Job *job)
+{
+    QMutexLocker locker(&_mutex);
+
+    _jobs.enqueue(job);
+    _cond.wakeOne();
+}
+
+void QtOrmExecutorThread::stop()
+{
+    QMutexLocker locker(&_mutex);
+
+    _stopping = true;
+    _cond.wakeOne();
+}
+
+void QtOrmExecutorThread::run()
+{
+    forever
+    {
+        QtOrmExecutor::Job *job;
+
+        {
+            QMutexLocker locker(&_mutex);
+
+            while (_jobs.isEmpty() && !_stopping)
+                _cond.wait(&_mutex);
+
+            if (_jobs.isEmpty())
+                return;
+
+            job = _jobs.dequeue();
+        }
+
+        // The job may be destroyed by run() (coroutines resume in it), don't touch it after
+        job->run();
+    }
+}
+
+/*
+ * QtOrmExecutor
+ */
+
+struct QtOrmExecutor::Private
+{
+    QVector<QtOrmExecutorThread *> threads;
+    QAtomicInt next_thread;
+};
+
+QtOrmExecutor::Job::~Job()
+{
+}
+
+QtOrmExecutor::QtOrmExecutor(int threads)
+: d(new Private)
+{
+    for (int i=0; i<qMax(threads, 1); ++i)
+    {
+        QtOrmExecutorThread *thread = new QtOrmExecutorThread;
+
+        thread->start();
+        d->threads.append(thread);
+    }
+}
+
+QtOrmExecutor::~QtOrmExecutor()
+{
+    for (int i=0; i<d->threads.count(); ++i)
+        d->threads.at(i)->stop();
+
+    for (int i=0; i<d->threads.count(); ++i)
+    {
+        d->threads.at(i)->wait();
+        delete d->threads.at(i);
+    }
+
+    delete d;
+}
+
+int QtOrmExecutor::threadCount() const
+{
+    return d->threads.count();
+}
+
+void QtOrmExecutor::post(Job *job, uint affinity)
+{
+    d->threads.at(affinity % d->threads.count())->post(job);
+}
+
+void QtOrmExecutor::post(Job *job)
+{
+    post(job, uint(d->next_thread.fetchAndAddRelaxed(1)));
+}
+
+QtOrmExecutor *QtOrmExecutor::globalInstance()
+{
+    static QMutex mutex;
+    static QtOrmExecutor *instance = NULL;
+
+    QMutexLocker locker(&mutex);
+
+    // Never destroyed, the threads may still be running jobs at exit
+    if (!instance)
+        instance = new QtOrmExecutor(QThread::idealThreadCount());
+
+    return instance;
+}
@@ -0,0 +1,66 @@
+/*
+ * qtormexecutor.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QTORMEXECUTOR_H__
+#define __QTORMEXECUTOR_H__
+
+#include <QtGlobal>
+
+/**
+ * @brief Small pool of threads running database work
+ *
+ * Each thread of the executor uses its own connection, given by
+ * QtOrmDatabase::threadDatabase() (enable per-thread databases). Jobs posted
+ * with the same affinity always run in the same thread, which is needed for
+ * querysets as they stay bound to the connection of the thread that built them.
+ *
+ * This is the engine of the coroutine interface of qtormcoro.h, but it can be
+ * used directly by any code able to post jobs.
+ */
+class QtOrmExecutor
+{
+    private:
+        Q_DISABLE_COPY(QtOrmExecutor)
+
+    public:
+        class Job
+        {
+            public:
+                virtual ~Job();
+                virtual void run() = 0;
+        };
+
+        QtOrmExecutor(int threads);
+        ~QtOrmExecutor();           /*!< @brief Runs the jobs already posted, then stops the threads */
+
+        int threadCount() const;
+        void post(Job *job, uint affinity);     /*!< @brief The job is not deleted by the executor */
+        void post(Job *job);                    /*!< @brief Run the job in any thread */
+
+        static QtOrmExecutor *globalInstance();
+
+    private:
+        struct Private;
+        Private *d;
+};
+
+#endif
@@ -0,0 +1,142 @@
+/*
+ * qtormfootprint_p.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QTORMFOOTPRINT_P_H__
+#define __QTORMFOOTPRINT_P_H__
+
+#include <QString>
+#include <QByteArray>
+#include <QVariant>
+#include <QVector>
+#include <QList>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+
+/*
+ * Heap size estimators used by the footprint report. They follow the Qt 4
+ * data layouts : a reference count, size and capacity header followed by the
+ * payload. Shared (implicitly or explicitly) data is counted for each holder.
+ */
+
+// QString::Data and QByteArray::Data, without the inline array
+static const qint64 qtormDataHeader = 4 * sizeof(int) + sizeof(void *);
+
+inline qint64 qtormHeapSize(const QString &str)
+{
+    if (str.isNull())
+        return 0;   // shared_null
+
+    return qtormDataHeader + (str.capacity() + 1) * sizeof(QChar);
+}
+
+inline qint64 qtormHeapSize(const QByteArray &array)
+{
+    if (array.isNull())
+        return 0;
+
+    return qtormDataHeader + array.capacity() + 1;
+}
+
+inline qint64 qtormHeapSize(const QVariantList &list);
+
+inline qint64 qtormHeapSize(const QVariant &value)
+{
+    // QVariant stores small types inline, only the payload of these ones is
+    // on the heap
+    switch (value.type())
+    {
+        case QVariant::String:
+            return qtormHeapSize(value.toString());
+        case QVariant::ByteArray:
+            return qtormHeapSize(value.toByteArray());
+        case QVariant::List:
+            return qtormHeapSize(value.toList());
+        default:
+            return 0;
+    }
+}
+
+inline qint64 qtormHeapSize(const QVariantList &list)
+{
+    // QListData header, the array of node pointers and one heap node per
+    // QVariant (it is a large type for QList)
+    qint64 rs = qtormDataHeader + list.count() * (sizeof(void *) + sizeof(QVariant));
+
+    for (int i=0; i<list.count(); ++i)
+        rs += qtormHeapSize(list.at(i));
+
+    return rs;
+}
+
+inline qint64 qtormHeapSize(const QStringList &list)
+{
+    // QString is stored inline in the node array
+    qint64 rs = qtormDataHeader + list.count() * sizeof(void *);
+
+    for (int i=0; i<list.count(); ++i)
+        rs += qtormHeapSize(list.at(i));
+
+    return rs;
+}
+
+inline qint64 qtormHeapSize(const QList<QVariantList> &rows)
+{
+    qint64 rs = qtormDataHeader + rows.count() * sizeof(void *);
+
+    for (int i=0; i<rows.count(); ++i)
+        rs += qtormHeapSize(rows.at(i));
+
+    return rs;
+}
+
+// QHashData, the bucket array and one node (next, hash, key, value) per item
+inline qint64 qtormHashHeapSize(int size, int buckets, qint64 itemSize)
+{
+    if (buckets == 0)
+        return 0;
+
+    return 2 * qtormDataHeader + buckets * sizeof(void *) + size * (sizeof(void *) + sizeof(uint) + itemSize);
+}
+
+template<typename K, typename V>
+inline qint64 qtormHeapSize(const QHash<K, V> &hash)
+{
+    return qtormHashHeapSize(hash.size(), hash.capacity(), sizeof(K) + sizeof(V));
+}
+
+template<typename T>
+inline qint64 qtormHeapSize(const QSet<T> &set)
+{
+    return qtormHashHeapSize(set.size(), set.capacity(), sizeof(T));
+}
+
+template<typename T>
+inline qint64 qtormVectorHeapSize(const QVector<T> &vector)
+{
+    if (vector.capacity() == 0)
+        return 0;
+
+    return qtormDataHeader + vector.capacity() * sizeof(T);
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * qtormjson_p.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QTORMJSON_P_H__
+#define __QTORMJSON_P_H__
+
+#include <QString>
+#include <QVariant>
+
+/*
+ * Minimal JSON output helpers, Qt 4 has no JSON support
+ */
+
+inline QString qtormJsonString(const QString &str)
+{
+    QString rs(QLatin1String("\""));
+
+    for (int i=0; i<str.size(); ++i)
+    {
+        QChar c = str.at(i);
+
+        if (c == QLatin1Char('"'))
+            rs += QLatin1String("\\\"");
+        else if (c == QLatin1Char('\\'))
+            rs += QLatin1String("\\\\");
+        else if (c == QLatin1Char('\n'))
+            rs += QLatin1String("\\n");
+        else if (c == QLatin1Char('\t'))
+            rs += QLatin1String("\\t");
+        else if (c.unicode() < 0x20)
+            rs += QString("\\u%1").arg(c.unicode(), 4, 16, QLatin1Char('0'));
+        else
+            rs += c;
+    }
+
+    rs += QLatin1Char('"');
+
+    return rs;
+}
+
+inline QString qtormJsonValue(const QVariant &value)
+{
+    if (value.isNull())
+        return QLatin1String("null");
+
+    switch (value.type())
+    {
+        case QVariant::Bool:
+            return value.toBool() ? QLatin1String("true") : QLatin1String("false");
+        case QVariant::Int:
+        case QVariant::UInt:
+        case QVariant::LongLong:
+        case QVariant::ULongLong:
+        case QVariant::Double:
+            return value.toString();
+        default:
+            return qtormJsonString(value.toString());
+    }
+}
+
+#endif
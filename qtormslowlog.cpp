@@ -0,0 +1,334 @@
+/*
+ * qtormslowlog.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "qtormslowlog.h"
+#include "qtormjson_p.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QFile>
+#include <QAtomicInt>
+#include <QDebug>
+
+// Entries queued when the writer is this late are dropped
+#define MAX_QUEUED_ENTRIES 1024
+
+class QtOrmSlowLogWriter : public QThread
+{
+    public:
+        QtOrmSlowLogWriter();
+
+        void post(const QtOrmSlowLog::Entry &entry);
+        void flush();
+
+        void setLogFile(const QString &fileName, qint64 maxBytes, int maxFiles);
+        void setCallback(QtOrmSlowLog::Callback callback);
+
+        int dropped() const;
+
+    protected:
+        void run();
+
+    private:
+        void write(const QtOrmSlowLog::Entry &entry);
+        void rotate();
+
+    private:
+        QMutex _mutex;
+        QWaitCondition _cond, _flushed;
+        QQueue<QtOrmSlowLog::Entry> _entries;
+        bool _writing;
+        QAtomicInt _dropped;
+
+        // Output, the query threads never take this lock
+        QMutex _output_mutex;
+        QFile _file;
+        QString _file_name;
+        qint64 _max_bytes;
+        int _max_files;
+        QtOrmSlowLog::Callback _callback;
+};
+
+static int slow_threshold = -1;
+static bool redact_values = false;
+
+static QtOrmSlowLogWriter *writer()
+{
+    static QMutex mutex;
+    static QtOrmSlowLogWriter *instance = NULL;
+
+    QMutexLocker locker(&mutex);
+
+    // Never destroyed, like the executor threads
+    if (!instance)
+    {
+        instance = new QtOrmSlowLogWriter;
+        instance->start(QThread::LowPriority);
+    }
+
+    return instance;
+}
+
+static QString entryToJson(const QtOrmSlowLog::Entry &entry)
+{
+    QString values;
+
+    for (int i=0; i<entry.values.count(); ++i)
+    {
+        if (i != 0)
+            values += QLatin1String(", ");
+
+        values += qtormJsonValue(entry.values.at(i));
+    }
+
+    // The SQL and the values are not passed to arg(), they may contain %1
+    return QString("{\"timestamp\": %1, \"total_ns\": %2, \"prepare_ns\": %3, \"exec_ns\": %4, \"fetch_ns\": %5, "
+                   "\"rows_returned\": %6, \"rows_affected\": %7, \"sql\": ")
+        .arg(qtormJsonString(entry.timestamp.toString(Qt::ISODate)))
+        .arg(entry.totalNsecs())
+        .arg(entry.sample.prepareNsecs)
+        .arg(entry.sample.execNsecs)
+        .arg(entry.sample.fetchNsecs)
+        .arg(entry.sample.rowsReturned)
+        .arg(entry.sample.rowsAffected)
+        + qtormJsonString(entry.sql)
+        + QLatin1String(", \"values\": [") + values + QLatin1String("]}\n");
+}
+
+/*
+ * QtOrmSlowLogWriter
+ */
+
+QtOrmSlowLogWriter::QtOrmSlowLogWriter()
+: _writing(false),
+  _max_bytes(0),
+  _max_files(0),
+  _callback(NULL)
+{
+}
+
+void QtOrmSlowLogWriter::post(const QtOrmSlowLog::Entry &entry)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (_entries.count() >= MAX_QUEUED_ENTRIES)
+    {
+        _dropped.ref();
+        return;
+    }
+
+    _entries.enqueue(entry);
+    _cond.wakeOne();
+}
+
+void QtOrmSlowLogWriter::flush()
+{
+    {
+        QMutexLocker locker(&_mutex);
+
+        while (!_entries.isEmpty() || _writing)
+            _flushed.wait(&_mutex);
+    }
+
+    QMutexLocker output_locker(&_output_mutex);
+
+    if (_file.isOpen())
+        _file.flush();
+}
+
+void QtOrmSlowLogWriter::setLogFile(const QString &fileName, qint64 maxBytes, int maxFiles)
+{
+    QMutexLocker locker(&_output_mutex);
+
+    _file.close();
+    _file_name = fileName;
+    _max_bytes = maxBytes;
+    _max_files = maxFiles;
+}
+
+void QtOrmSlowLogWriter::setCallback(QtOrmSlowLog::Callback callback)
+{
+    QMutexLocker locker(&_output_mutex);
+
+    _callback = callback;
+}
+
+int QtOrmSlowLogWriter::dropped() const
+{
+    return _dropped;
+}
+
+void QtOrmSlowLogWriter::run()
+{
+    forever
+    {
+        QtOrmSlowLog::Entry entry;
+
+        {
+            QMutexLocker locker(&_mutex);
+
+            _writing = false;
+
+            if (_entries.isEmpty())
+                _flushed.wakeAll();
+
+            while (_entries.isEmpty())
+                _cond.wait(&_mutex);
+
+            entry = _entries.dequeue();
+            _writing = true;
+        }
+
+        // Written outside the lock, so that the query threads never wait for the disk
+        write(entry);
+    }
+}
+
+void QtOrmSlowLogWriter::write(const QtOrmSlowLog::Entry &entry)
+{
+    QMutexLocker locker(&_output_mutex);
+
+    if (_callback)
+        _callback(entry);
+
+    if (_file_name.isEmpty())
+        return;
+
+    if (!_file.isOpen())
+    {
+        _file.setFileName(_file_name);
+
+        if (!_file.open(QIODevice::WriteOnly | QIODevice::Append))
+        {
+            qDebug() << "Cannot open the slow query log" << _file_name << ":" << _file.errorString();
+            _file_name.clear();
+            return;
+        }
+    }
+
+    _file.write(entryToJson(entry).toUtf8());
+
+    if (_max_bytes > 0 && _file.size() >= _max_bytes)
+        rotate();
+}
+
+void QtOrmSlowLogWriter::rotate()
+{
+    _file.close();
+
+    // fileName.(n-1) -> fileName.n, ..., fileName -> fileName.1
+    QFile::remove(QString("%1.%2").arg(_file_name).arg(_max_files));
+
+    for (int i=_max_files - 1; i>0; --i)
+        QFile::rename(QString("%1.%2").arg(_file_name).arg(i), QString("%1.%2").arg(_file_name).arg(i + 1));
+
+    if (_max_files > 0)
+        QFile::rename(_file_name, _file_name + QLatin1String(".1"));
+    else
+        QFile::remove(_file_name);
+}
+
+/*
+ * QtOrmSlowLog
+ */
+
+qint64 QtOrmSlowLog::Entry::totalNsecs() const
+{
+    return sample.prepareNsecs + sample.execNsecs + sample.fetchNsecs;
+}
+
+void QtOrmSlowLog::setThreshold(int msecs)
+{
+    slow_threshold = msecs;
+}
+
+int QtOrmSlowLog::threshold()
+{
+    return slow_threshold;
+}
+
+bool QtOrmSlowLog::isEnabled()
+{
+    return slow_threshold >= 0;
+}
+
+void QtOrmSlowLog::setRedactValues(bool redact)
+{
+    redact_values = redact;
+}
+
+bool QtOrmSlowLog::redactValues()
+{
+    return redact_values;
+}
+
+void QtOrmSlowLog::setLogFile(const QString &fileName, qint64 maxBytes, int maxFiles)
+{
+    writer()->setLogFile(fileName, maxBytes, maxFiles);
+}
+
+void QtOrmSlowLog::setCallback(Callback callback)
+{
+    writer()->setCallback(callback);
+}
+
+void QtOrmSlowLog::flush()
+{
+    writer()->flush();
+}
+
+int QtOrmSlowLog::droppedEntries()
+{
+    return writer()->dropped();
+}
+
+void QtOrmSlowLog::log(const QString &sql, const QVariantList &values, const QtOrmStatementSample &sample)
+{
+    if (slow_threshold < 0)
+        return;
+
+    Entry entry;
+
+    entry.sample = sample;
+
+    if (entry.totalNsecs() < qint64(slow_threshold) * 1000000)
+        return;
+
+    entry.timestamp = QDateTime::currentDateTime();
+    entry.sql = sql;
+
+    if (!redact_values)
+    {
+        entry.values = values;
+    }
+    else
+    {
+        // Keep only the types, enough to tell which filter was used
+        for (int i=0; i<values.count(); ++i)
+            entry.values.append(QString("<%1>").arg(values.at(i).typeName()));
+    }
+
+    writer()->post(entry);
+}
@@ -0,0 +1,84 @@
+/*
+ * qtormslowlog.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QTORMSLOWLOG_H__
+#define __QTORMSLOWLOG_H__
+
+#include <QString>
+#include <QVariant>
+#include <QDateTime>
+
+#include "qtormstats.h"
+
+/**
+ * @brief Log of the statements slower than a threshold
+ *
+ * Every statement run by a queryset or a model whose prepare, execute and
+ * fetch times add up to more than threshold() is logged, with its SQL and
+ * its bound values. The entries are written to a file or passed to a callback
+ * by a background thread, the thread running the statement only queues them.
+ *
+ * The log is disabled by default (the threshold is -1).
+ */
+class QtOrmSlowLog
+{
+    public:
+        struct Entry
+        {
+            QDateTime timestamp;
+            QString sql;
+            QVariantList values;            /*!< @brief Bound values, replaced by their type name if redacted */
+            QtOrmStatementSample sample;
+
+            qint64 totalNsecs() const;
+        };
+
+        typedef void (*Callback)(const Entry &entry);
+
+        static void setThreshold(int msecs);    /*!< @brief Minimum duration of a logged statement, -1 to disable the log */
+        static int threshold();
+        static bool isEnabled();
+
+        static void setRedactValues(bool redact);
+        static bool redactValues();
+
+        /**
+         * @brief Write the entries to @p fileName, one JSON object per line
+         *
+         * When the file grows larger than @p maxBytes, it is renamed to
+         * fileName.1, fileName.1 to fileName.2, and so on. Only @p maxFiles
+         * old files are kept. An empty file name disables the file output.
+         */
+        static void setLogFile(const QString &fileName, qint64 maxBytes = 10 * 1024 * 1024, int maxFiles = 5);
+
+        /**
+         * @brief Call @p callback for every entry, from the writer thread
+         */
+        static void setCallback(Callback callback);
+
+        static void flush();            /*!< @brief Wait until the queued entries are written */
+        static int droppedEntries();    /*!< @brief Entries dropped because the writer could not keep up */
+
+        static void log(const QString &sql, const QVariantList &values, const QtOrmStatementSample &sample);
+};
+
+#endif
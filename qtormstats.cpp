@@ -0,0 +1,337 @@
+/*
+ * qtormstats.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "qtormstats.h"
+#include "qtormdatabase.h"
+#include "qtormslowlog.h"
+#include "qtormjson_p.h"
+
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QMutex>
+#include <QMutexLocker>
+
+// Histogram buckets: 0 is < 1 µs, then bucket i is [2^(i-1), 2^i[ µs
+#define HISTOGRAM_BUCKETS 32
+
+struct PhaseStats
+{
+    PhaseStats()
+     : total(0), max(0)
+    {
+        for (int i=0; i<HISTOGRAM_BUCKETS; ++i)
+            histogram[i] = 0;
+    }
+
+    void add(qint64 nsecs)
+    {
+        qint64 usecs = nsecs / 1000;
+        int bucket = 0;
+
+        while (usecs > 0 && bucket < HISTOGRAM_BUCKETS - 1)
+        {
+            usecs >>= 1;
+            bucket++;
+        }
+
+        total += nsecs;
+        max = qMax(max, nsecs);
+        histogram[bucket]++;
+    }
+
+    void merge(const PhaseStats &other)
+    {
+        total += other.total;
+        max = qMax(max, other.max);
+
+        for (int i=0; i<HISTOGRAM_BUCKETS; ++i)
+            histogram[i] += other.histogram[i];
+    }
+
+    QString toJson() const
+    {
+        QString rs = QString("{\"total_ns\": %1, \"max_ns\": %2, \"histogram_us\": [")
+            .arg(total)
+            .arg(max);
+
+        for (int i=0; i<HISTOGRAM_BUCKETS; ++i)
+        {
+            if (i != 0)
+                rs += QLatin1String(", ");
+
+            rs += QString::number(histogram[i]);
+        }
+
+        rs += QLatin1String("]}");
+
+        return rs;
+    }
+
+    qint64 total;
+    qint64 max;
+    qint64 histogram[HISTOGRAM_BUCKETS];
+};
+
+struct ShapeStats
+{
+    ShapeStats()
+     : calls(0), rows_returned(0), rows_affected(0)
+    {
+    }
+
+    void merge(const ShapeStats &other)
+    {
+        calls += other.calls;
+        rows_returned += other.rows_returned;
+        rows_affected += other.rows_affected;
+        prepare.merge(other.prepare);
+        exec.merge(other.exec);
+        fetch.merge(other.fetch);
+    }
+
+    qint64 calls;
+    qint64 rows_returned;
+    qint64 rows_affected;
+    PhaseStats prepare, exec, fetch;
+};
+
+// Statistics of a thread, only locked against the readers
+struct Shard
+{
+    QMutex mutex;
+    QHash<QString, ShapeStats> shapes;
+};
+
+static bool stats_enabled = false;
+
+static QMutex shards_mutex;
+static QList<Shard *> shards;
+static __thread Shard *thread_shard = NULL;
+
+QtOrmStatementSample::QtOrmStatementSample()
+ : prepareNsecs(0),
+   execNsecs(0),
+   fetchNsecs(0),
+   rowsReturned(0),
+   rowsAffected(0)
+{
+}
+
+void QtOrmStats::setEnabled(bool enable)
+{
+    stats_enabled = enable;
+}
+
+bool QtOrmStats::isEnabled()
+{
+    return stats_enabled;
+}
+
+bool QtOrmStats::isTimed()
+{
+    return stats_enabled || QtOrmSlowLog::isEnabled();
+}
+
+QString QtOrmStats::normalize(const QString &sql)
+{
+    // Collapse lists of placeholders, "?, ?, ?" becomes "?, ..."
+    QString collapsed;
+    int i = 0;
+
+    collapsed.reserve(sql.size());
+
+    while (i < sql.size())
+    {
+        QChar c = sql.at(i++);
+
+        collapsed += c;
+
+        if (c != QLatin1Char('?'))
+            continue;
+
+        bool repeated = false;
+
+        while (i + 2 < sql.size() &&
+               sql.at(i) == QLatin1Char(',') &&
+               sql.at(i + 1) == QLatin1Char(' ') &&
+               sql.at(i + 2) == QLatin1Char('?'))
+        {
+            i += 3;
+            repeated = true;
+        }
+
+        if (repeated)
+            collapsed += QLatin1String(", ...");
+    }
+
+    // Collapse repeated groups, "(?, ...), (?, ...)" becomes "(?, ...), ..."
+    QString rs;
+
+    i = 0;
+    rs.reserve(collapsed.size());
+
+    while (i < collapsed.size())
+    {
+        if (collapsed.at(i) != QLatin1Char('('))
+        {
+            rs += collapsed.at(i++);
+            continue;
+        }
+
+        int close = collapsed.indexOf(QLatin1Char(')'), i);
+
+        if (close == -1)
+        {
+            rs += collapsed.mid(i);
+            break;
+        }
+
+        QString group = collapsed.mid(i, close - i + 1);
+        QString next_group = QLatin1String(", ") + group;
+        bool repeated = false;
+
+        rs += group;
+        i = close + 1;
+
+        while (collapsed.mid(i, next_group.size()) == next_group)
+        {
+            i += next_group.size();
+            repeated = true;
+        }
+
+        if (repeated)
+            rs += QLatin1String(", ...");
+    }
+
+    return rs;
+}
+
+void QtOrmStats::record(const QString &normalizedSql, const QtOrmStatementSample &sample)
+{
+    if (!thread_shard)
+    {
+        thread_shard = new Shard;
+
+        // Shards are never deleted, the statistics of finished threads are kept
+        QMutexLocker locker(&shards_mutex);
+        shards.append(thread_shard);
+    }
+
+    QMutexLocker locker(&thread_shard->mutex);
+    ShapeStats &stats = thread_shard->shapes[normalizedSql];
+
+    stats.calls++;
+    stats.rows_returned += sample.rowsReturned;
+    stats.rows_affected += sample.rowsAffected;
+    stats.prepare.add(sample.prepareNsecs);
+    stats.exec.add(sample.execNsecs);
+    stats.fetch.add(sample.fetchNsecs);
+}
+
+QString QtOrmStats::toJson()
+{
+    QHash<QString, ShapeStats> merged;
+
+    {
+        QMutexLocker locker(&shards_mutex);
+
+        for (int i=0; i<shards.count(); ++i)
+        {
+            QMutexLocker shard_locker(&shards.at(i)->mutex);
+            const QHash<QString, ShapeStats> &shapes = shards.at(i)->shapes;
+
+            for (QHash<QString, ShapeStats>::const_iterator it = shapes.constBegin(); it != shapes.constEnd(); ++it)
+                merged[it.key()].merge(it.value());
+        }
+    }
+
+    QtOrmDatabase::RetryStats retries = QtOrmDatabase::retryStats();
+    QString rs = QLatin1String("{\n  \"statements\": [");
+    bool first = true;
+
+    for (QHash<QString, ShapeStats>::const_iterator it = merged.constBegin(); it != merged.constEnd(); ++it)
+    {
+        const ShapeStats &stats = it.value();
+
+        if (!first)
+            rs += QLatin1Char(',');
+
+        // The SQL is not passed to arg(), it may contain %1
+        rs += QLatin1String("\n    {\"sql\": ") + qtormJsonString(it.key());
+        rs += QString(", \"calls\": %1, \"rows_returned\": %2, \"rows_affected\": %3,\n"
+                      "     \"prepare\": %4,\n     \"exec\": %5,\n     \"fetch\": %6}")
+            .arg(stats.calls)
+            .arg(stats.rows_returned)
+            .arg(stats.rows_affected)
+            .arg(stats.prepare.toJson())
+            .arg(stats.exec.toJson())
+            .arg(stats.fetch.toJson());
+
+        first = false;
+    }
+
+    rs += QString("\n  ],\n  \"retries\": {\"retries\": %1, \"reconnects\": %2, \"failures\": %3}")
+        .arg(retries.retries)
+        .arg(retries.reconnects)
+        .arg(retries.failures);
+
+    if (hasAllocationStats())
+    {
+        rs += QString(",\n  \"allocations_counted\": \"%1\"").arg(QLatin1String(allocationHook()));
+        rs += QLatin1String(",\n  \"allocations\": {");
+
+        for (int i=0; i<OperationCount; ++i)
+        {
+            Allocations allocs = allocations((Operation)i);
+
+            if (i != 0)
+                rs += QLatin1String(", ");
+
+            rs += QString("\"%1\": {\"count\": %2, \"bytes\": %3}")
+                .arg(operationName((Operation)i))
+                .arg(allocs.count)
+                .arg(allocs.bytes);
+        }
+
+        rs += QLatin1Char('}');
+    }
+
+    rs += QLatin1String("\n}\n");
+
+    return rs;
+}
+
+void QtOrmStats::reset()
+{
+    QMutexLocker locker(&shards_mutex);
+
+    for (int i=0; i<shards.count(); ++i)
+    {
+        QMutexLocker shard_locker(&shards.at(i)->mutex);
+
+        shards.at(i)->shapes.clear();
+    }
+
+    QtOrmDatabase::resetRetryStats();
+    resetAllocations();
+}
@@ -0,0 +1,90 @@
+/*
+ * qtormstats.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QTORMSTATS_H__
+#define __QTORMSTATS_H__
+
+#include <QString>
+
+/**
+ * @brief Timings of one execution of a statement
+ */
+struct QtOrmStatementSample
+{
+    QtOrmStatementSample();
+
+    qint64 prepareNsecs;    /*!< @brief Preparing the statement, or taking it from the statement cache */
+    qint64 execNsecs;
+    qint64 fetchNsecs;      /*!< @brief Fetching the rows and populating the models */
+    int rowsReturned;
+    int rowsAffected;
+};
+
+/**
+ * @brief Statistics of the statements run by QtORM, per query shape
+ *
+ * The statements are identified by their SQL, normalized so that IN lists
+ * and batch inserts of any size share the same statistics. Every thread
+ * records in its own table, the tables are merged when read.
+ *
+ * The statistics are disabled by default, as timing every row has a cost.
+ */
+class QtOrmStats
+{
+    public:
+        static void setEnabled(bool enable);
+        static bool isEnabled();
+        static bool isTimed();      /*!< @brief Statements have to be timed, for the statistics or the slow query log */
+
+        static QString normalize(const QString &sql);
+        static void record(const QString &normalizedSql, const QtOrmStatementSample &sample);
+
+        static QString toJson();
+        static void reset();
+
+        // Memory allocations of QtORM statements, only counted when QtORM is built with QTORM_ALLOC_STATS
+        enum Operation
+        {
+            OtherOperation,         /*!< @brief Executing statements and fetching their rows, outside of the operations below */
+            ExpressionOperation,    /*!< @brief Not counted, the QWhere and QAssign trees are built by the application */
+            BuildOperation,         /*!< @brief Generating SQL */
+            BindOperation,          /*!< @brief Collecting and binding the values of a statement */
+            HydrateOperation,       /*!< @brief Populating models with fetched rows */
+            SaveOperation,          /*!< @brief Saving and removing models, except building and binding */
+            OperationCount
+        };
+
+        struct Allocations
+        {
+            qint64 count;
+            qint64 bytes;
+        };
+
+        static bool hasAllocationStats();
+        static const char *allocationHook();   /*!< @brief "malloc", "operator new" when the Qt containers are not counted, "none" without the preloaded library */
+        static Allocations allocations(Operation operation);
+        static Allocations totalAllocations();
+        static const char *operationName(Operation operation);
+        static void resetAllocations();
+};
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * qtormtracer.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "qtormtracer.h"
+#include "qtormjson_p.h"
+
+#include <QCoreApplication>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QFile>
+#include <QtDebug>
+
+static QtOrmTracer *current_tracer = NULL;
+static QElapsedTimer tracer_clock;
+
+QtOrmTracer::~QtOrmTracer()
+{
+}
+
+void QtOrmTracer::setTracer(QtOrmTracer *tracer)
+{
+    if (!tracer_clock.isValid())
+        tracer_clock.start();
+
+    current_tracer = tracer;
+}
+
+QtOrmTracer *QtOrmTracer::tracer()
+{
+    return current_tracer;
+}
+
+qint64 QtOrmTracer::nsecsElapsed()
+{
+    return tracer_clock.nsecsElapsed();
+}
+
+const char *QtOrmTracer::spanName(SpanKind kind)
+{
+    switch (kind)
+    {
+        case BuildSpan:
+            return "build";
+        case PrepareSpan:
+            return "prepare";
+        case ExecSpan:
+            return "exec";
+        case FetchSpan:
+            return "fetch";
+        case UpdateSpan:
+            return "update";
+        case SaveSpan:
+            return "save";
+        case SaveBatchSpan:
+            return "saveBatch";
+        case RemoveSpan:
+            return "remove";
+        case ForeignKeySpan:
+            return "foreignKey";
+    }
+
+    return "unknown";
+}
+
+/*
+ * QtOrmChromeTracer
+ */
+
+struct QtOrmChromeTracer::Private
+{
+    QString file_name;
+
+    QMutex mutex;
+    QStringList events;
+};
+
+QtOrmChromeTracer::QtOrmChromeTracer(const QString &fileName)
+: d(new Private)
+{
+    d->file_name = fileName;
+}
+
+QtOrmChromeTracer::~QtOrmChromeTracer()
+{
+    flush();
+
+    delete d;
+}
+
+void QtOrmChromeTracer::beginSpan(Span &span)
+{
+    // Complete events are written when the span ends
+    Q_UNUSED(span);
+}
+
+void QtOrmChromeTracer::endSpan(Span &span)
+{
+    QString args;
+
+    if (!span.fingerprint.isEmpty())
+        args = QLatin1String("\"sql\": ") + qtormJsonString(span.fingerprint);
+
+    if (span.rows != -1)
+    {
+        if (!args.isEmpty())
+            args += QLatin1String(", ");
+
+        args += QString("\"rows\": %1").arg(span.rows);
+    }
+
+    // The args are not passed to arg(), the SQL may contain %1
+    QString event = QString("{\"name\": \"%1\", \"cat\": \"qtorm\", \"ph\": \"X\", \"ts\": %2, \"dur\": %3, \"pid\": %4, \"tid\": %5, \"args\": {")
+        .arg(spanName(span.kind))
+        .arg(span.startNsecs / 1000.0, 0, 'f', 3)
+        .arg((span.endNsecs - span.startNsecs) / 1000.0, 0, 'f', 3)
+        .arg(QCoreApplication::applicationPid())
+        .arg(quintptr(QThread::currentThreadId()))
+        + args + QLatin1String("}}");
+
+    QMutexLocker locker(&d->mutex);
+
+    d->events.append(event);
+}
+
+bool QtOrmChromeTracer::flush()
+{
+    QMutexLocker locker(&d->mutex);
+    QFile file(d->file_name);
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qDebug() << "Cannot write the trace" << d->file_name << ":" << file.errorString();
+        return false;
+    }
+
+    // All the events are rewritten, so that the file is always complete
+    file.write("{\"traceEvents\": [\n");
+    file.write(d->events.join(QLatin1String(",\n")).toUtf8());
+    file.write("\n]}\n");
+
+    return true;
+}
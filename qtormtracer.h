@@ -0,0 +1,97 @@
+/*
+ * qtormtracer.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QTORMTRACER_H__
+#define __QTORMTRACER_H__
+
+#include <QString>
+
+/**
+ * @brief Receives spans around the work done by QtORM
+ *
+ * Install a tracer with setTracer() to forward the spans to a distributed
+ * tracing system. beginSpan() and endSpan() are called from the threads
+ * running the statements, and spans of a same thread are properly nested,
+ * except the fetch spans: they cover the iteration over the rows of a
+ * queryset, including the application code run between calls to next().
+ */
+class QtOrmTracer
+{
+    public:
+        enum SpanKind
+        {
+            BuildSpan,          /*!< @brief Generating the SQL of a queryset */
+            PrepareSpan,
+            ExecSpan,
+            FetchSpan,
+            UpdateSpan,         /*!< @brief QQuerySet::update() */
+            SaveSpan,           /*!< @brief QModel::save(), containing a SaveBatchSpan for inserts */
+            SaveBatchSpan,
+            RemoveSpan,
+            ForeignKeySpan      /*!< @brief Fetching the target of a foreign key (QForeignKey::value()) */
+        };
+
+        struct Span
+        {
+            SpanKind kind;
+            QString fingerprint;    /*!< @brief Normalized SQL (see QtOrmStats::normalize()), may be set only at the end */
+            int rows;               /*!< @brief Rows fetched or affected, set at the end, -1 if not relevant */
+            qint64 startNsecs;      /*!< @brief Since setTracer() */
+            qint64 endNsecs;        /*!< @brief Since setTracer(), set at the end */
+            void *data;             /*!< @brief Free for the tracer */
+        };
+
+        virtual ~QtOrmTracer();
+
+        virtual void beginSpan(Span &span) = 0;
+        virtual void endSpan(Span &span) = 0;
+
+        static void setTracer(QtOrmTracer *tracer);     /*!< @brief Not owned, NULL (the default) disables tracing */
+        static QtOrmTracer *tracer();
+        static qint64 nsecsElapsed();
+
+        static const char *spanName(SpanKind kind);
+};
+
+/**
+ * @brief Tracer writing the spans to a Chrome trace-event file
+ *
+ * The file can be opened in chrome://tracing or Perfetto. The events are
+ * kept in memory and written by flush() or when the tracer is destroyed.
+ */
+class QtOrmChromeTracer : public QtOrmTracer
+{
+    public:
+        QtOrmChromeTracer(const QString &fileName);
+        ~QtOrmChromeTracer();
+
+        void beginSpan(Span &span);
+        void endSpan(Span &span);
+
+        bool flush();
+
+    private:
+        struct Private;
+        Private *d;
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * qtormtracer_p.h
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __QTORMTRACER_P_H__
+#define __QTORMTRACER_P_H__
+
+#include "qtormtracer.h"
+#include "qtormstats.h"
+
+/*
+ * A span, begun when created and ended when destroyed. Does nothing when no
+ * tracer is installed.
+ */
+class QtOrmSpan
+{
+    public:
+        inline QtOrmSpan(QtOrmTracer::SpanKind kind)
+         : _tracer(QtOrmTracer::tracer())
+        {
+            if (!_tracer)
+                return;
+
+            _span.kind = kind;
+            _span.rows = -1;
+            _span.startNsecs = QtOrmTracer::nsecsElapsed();
+            _span.endNsecs = 0;
+            _span.data = 0;
+
+            _tracer->beginSpan(_span);
+        }
+
+        inline ~QtOrmSpan()
+        {
+            if (!_tracer)
+                return;
+
+            _span.endNsecs = QtOrmTracer::nsecsElapsed();
+            _tracer->endSpan(_span);
+        }
+
+        inline bool isActive() const
+        {
+            return _tracer != 0;
+        }
+
+        inline void setSql(const QString &sql)
+        {
+            if (_tracer)
+                _span.fingerprint = QtOrmStats::normalize(sql);
+        }
+
+        inline void setFingerprint(const QString &fingerprint)
+        {
+            if (_tracer)
+                _span.fingerprint = fingerprint;
+        }
+
+        inline void setRows(int rows)
+        {
+            _span.rows = rows;
+        }
+
+        inline void addRow()
+        {
+            _span.rows++;
+        }
+
+    private:
+        QtOrmTracer *_tracer;
+        QtOrmTracer::Span _span;
+};
+
+#endif
@@ -22,9 +22,19 @@
 
 #include "qwhere.h"
 #include "qfield.h"
+#include "qqueryset.h"
+#include "qqueryset_p.h"
+#include "qtormfootprint_p.h"
+#include "qtormdatabase.h"
 
 #include <QtDebug>
 #include <QSqlDriver>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QHash>
 
 /*
  * QWhere
@@ -38,16 +48,23 @@ class QWherePrivate
 
         QWhere::Condition condition() const;
         QString fieldName(const QField &field, QSqlDriver *driver) const;
+        static QQuerySetPrivate *relatedQuerySet(const QField &left, const QField &foreignKey, const QWhere &cond);
 
         void ref();
         bool deref();
 
         virtual QString sql(QSqlDriver *driver) const = 0;
-        virtual void bindValues(QVariantList &values) const = 0;
+        virtual void bindValues(QVariantList &values, QSqlDriver *driver) const = 0;
+        virtual qint64 heapSize() const = 0;
+        virtual bool hasSubquery() const;
+
+        // Statements to run before and after the one using the filter
+        virtual bool setUp(const QSqlDatabase &db) const;
+        virtual void tearDown(const QSqlDatabase &db) const;
 
     private:
         QWhere::Condition _cond;
-        unsigned int _refcount;
+        QAtomicInt _refcount;
 };
 
 QWherePrivate::QWherePrivate(QWhere::Condition cond) : _cond(cond), _refcount(1)
@@ -65,14 +82,12 @@ QWhere::Condition QWherePrivate::condition() const
 
 void QWherePrivate::ref()
 {
-    _refcount++;
+    _refcount.ref();
 }
 
 bool QWherePrivate::deref()
 {
-    _refcount--;
-
-    return (_refcount != 0);
+    return _refcount.deref();
 }
 
 QString QWherePrivate::fieldName(const QField &field, QSqlDriver *driver) const
@@ -80,13 +95,45 @@ QString QWherePrivate::fieldName(const QField &field, QSqlDriver *driver) const
     return driver->escapeIdentifier(field.fieldName(), QSqlDriver::FieldName);
 }
 
+bool QWherePrivate::hasSubquery() const
+{
+    return false;
+}
+
+bool QWherePrivate::setUp(const QSqlDatabase &db) const
+{
+    (void) db;
+
+    return true;
+}
+
+void QWherePrivate::tearDown(const QSqlDatabase &db) const
+{
+    (void) db;
+}
+
+QQuerySetPrivate *QWherePrivate::relatedQuerySet(const QField &left, const QField &foreignKey, const QWhere &cond)
+{
+    // Rows of the model of the foreign key pointing to left, and matching cond
+    QQuerySetPrivate *rs = new QQuerySetPrivate(foreignKey.model());
+
+    rs->excludeField(foreignKey);   // No need to join with the outer table
+    rs->addFilter(QFFWhere(foreignKey, left, QWhere::Equal));
+
+    if (cond.isValid())
+        rs->addFilter(cond);
+
+    return rs;
+}
+
 QWhere::QWhere() : d(NULL)
 {
 }
 
 QWhere::QWhere(const QWhere &other) : d(other.d)
 {
-    d->ref();
+    if (d)
+        d->ref();
 }
 
 QWhere::QWhere(QWherePrivate *d) : d(d)
@@ -99,6 +146,16 @@ QWhere::~QWhere()
         delete d;
 }
 
+QWhere QWhere::exists(QQuerySet &subquery)
+{
+    return QExistsWhere(subquery, Exists);
+}
+
+QWhere QWhere::notExists(QQuerySet &subquery)
+{
+    return QExistsWhere(subquery, NotExists);
+}
+
 bool QWhere::isValid() const
 {
     return (d != NULL);
@@ -121,16 +178,33 @@ QWhere QWhere::operator||(const QWhere &other) const
 
 QWhere &QWhere::operator=(const QWhere &other)
 {
+    // Reference the new tree first, so that self-assignment is safe
+    if (other.d)
+        other.d->ref();
+
     if (d && !d->deref())
         delete d;
 
     d = other.d;
 
-    if (d)
-        d->ref();
+    return *this;
+}
+
+#if defined(__GXX_EXPERIMENTAL_CXX0X__)
+QWhere &QWhere::operator=(QWhere &&other)
+{
+    if (this != &other)
+    {
+        if (d && !d->deref())
+            delete d;
+
+        d = other.d;
+        other.d = nullptr;
+    }
 
     return *this;
 }
+#endif
 
 QString QWhere::conditionStr(QWhere::Condition cond)
 {
@@ -160,6 +234,12 @@ QString QWhere::conditionStr(QWhere::Condition cond)
             return QLatin1String("NOT ");
         case Like:
             return QLatin1String(" LIKE ");
+        case NotIn:
+            return QLatin1String(" NOT IN ");
+        case Exists:
+            return QLatin1String("EXISTS ");
+        case NotExists:
+            return QLatin1String("NOT EXISTS ");
     }
 
     return QString();
@@ -170,15 +250,51 @@ QString QWhere::sql(QSqlDriver *driver) const
     return d->sql(driver);
 }
 
-void QWhere::bindValues(QVariantList &values) const
+void QWhere::bindValues(QVariantList &values, QSqlDriver *driver) const
+{
+    d->bindValues(values, driver);
+}
+
+qint64 QWhere::heapSize() const
+{
+    return d ? d->heapSize() : 0;
+}
+
+bool QWhere::hasSubquery() const
+{
+    return d && d->hasSubquery();
+}
+
+bool QWhere::setUp(const QSqlDatabase &db) const
 {
-    d->bindValues(values);
+    return d->setUp(db);
+}
+
+void QWhere::tearDown(const QSqlDatabase &db) const
+{
+    d->tearDown(db);
 }
 
 /*
  * QFInWhere
  */
 
+static QWhere::InListStrategy in_list_strategy = QWhere::InAutomatic;
+// Leaves room for the other parameters of the statement below the 999 of SQLite
+static int in_list_threshold = 500;
+
+// Rows inserted at once in the temporary tables, two parameters each, below the limit of SQLite
+#define IN_LIST_INSERT_ROWS 250
+
+// Identifiers of the lists loaded in the temporary tables
+static QAtomicInt in_list_sets;
+
+void QWhere::setInListStrategy(InListStrategy strategy, int threshold)
+{
+    in_list_strategy = strategy;
+    in_list_threshold = threshold;
+}
+
 class QFInWherePrivate : public QWherePrivate
 {
     public:
@@ -186,11 +302,39 @@ class QFInWherePrivate : public QWherePrivate
         ~QFInWherePrivate();
 
         QString sql(QSqlDriver *driver) const;
-        void bindValues(QVariantList &values) const;
+        void bindValues(QVariantList &values, QSqlDriver *driver) const;
+        qint64 heapSize() const;
+
+        bool setUp(const QSqlDatabase &db) const;
+        void tearDown(const QSqlDatabase &db) const;
+
+    private:
+        enum Mode
+        {
+            Placeholders,
+            Array,
+            TemporaryTable
+        };
+
+        Mode mode(QSqlDriver *driver) const;
+        QString arrayLiteral() const;
+        QString tableName(QSqlDriver *driver) const;
+        QString columnType() const;
+
+        // List loaded in the temporary table of a connection
+        struct LoadedSet
+        {
+            int id;
+            int users;      // Statements using it, it is deleted by the last one
+        };
 
     private:
         QField _f;
         QVariantList _list;
+
+        // Copies of the filter share this object, in several statements and threads
+        mutable QMutex _sets_mutex;
+        mutable QHash<QSqlDriver *, LoadedSet> _sets;
 };
 
 QFInWherePrivate::QFInWherePrivate(const QField &left, const QVariantList &right)
@@ -202,10 +346,113 @@ QFInWherePrivate::~QFInWherePrivate()
 {
 }
 
+QFInWherePrivate::Mode QFInWherePrivate::mode(QSqlDriver *driver) const
+{
+    if (in_list_strategy == QWhere::InPlaceholders || _list.count() <= in_list_threshold)
+        return Placeholders;
+
+    // Only PostgreSQL has arrays, its driver handle is a PGconn
+    if (in_list_strategy == QWhere::InAutomatic &&
+        QByteArray(driver->handle().typeName()) == QByteArray("PGconn*"))
+        return Array;
+
+    return TemporaryTable;
+}
+
+QString QFInWherePrivate::tableName(QSqlDriver *driver) const
+{
+    // One table per column type and connection, shared by all the lists. The
+    // statements are the same whatever the list, and can be cached.
+    QString name = QLatin1String("qtorm_in_") + columnType().replace(QLatin1Char(' '), QLatin1Char('_')).toLower();
+
+    return driver->escapeIdentifier(name, QSqlDriver::TableName);
+}
+
+QString QFInWherePrivate::columnType() const
+{
+    QVariant::Type type = QVariant::String;
+
+    for (int i=0; i<_list.count(); ++i)
+    {
+        if (!_list.at(i).isNull())
+        {
+            type = _list.at(i).type();
+            break;
+        }
+    }
+
+    switch (type)
+    {
+        case QVariant::Bool:
+        case QVariant::Int:
+        case QVariant::UInt:
+        case QVariant::LongLong:
+        case QVariant::ULongLong:
+            return QLatin1String("BIGINT");
+        case QVariant::Double:
+            return QLatin1String("DOUBLE PRECISION");
+        default:
+            return QLatin1String("TEXT");
+    }
+}
+
+QString QFInWherePrivate::arrayLiteral() const
+{
+    // {1,2,3} or {"a","b"}, the server casts it to an array of the type of the field
+    QString rs(QLatin1String("{"));
+
+    for (int i=0; i<_list.count(); ++i)
+    {
+        const QVariant &value = _list.at(i);
+
+        if (i != 0)
+            rs += QLatin1Char(',');
+
+        if (value.isNull())
+        {
+            rs += QLatin1String("NULL");
+        }
+        else if (value.type() == QVariant::String || value.type() == QVariant::DateTime)
+        {
+            QString str = value.toString();
+
+            str.replace(QLatin1String("\\"), QLatin1String("\\\\"));
+            str.replace(QLatin1String("\""), QLatin1String("\\\""));
+
+            rs += QLatin1Char('"') + str + QLatin1Char('"');
+        }
+        else
+        {
+            rs += value.toString();
+        }
+    }
+
+    rs += QLatin1Char('}');
+
+    return rs;
+}
+
 QString QFInWherePrivate::sql(QSqlDriver *driver) const
 {
     QString rs(fieldName(_f, driver));
 
+    switch (mode(driver))
+    {
+        case Array:
+            rs += QLatin1String(" = ANY(?)");
+            return rs;
+
+        case TemporaryTable:
+            rs += QWhere::conditionStr(QWhere::In) + QLatin1String("(SELECT ");
+            rs += driver->escapeIdentifier(QLatin1String("value"), QSqlDriver::FieldName);
+            rs += QLatin1String(" FROM ") + tableName(driver) + QLatin1String(" WHERE ");
+            rs += driver->escapeIdentifier(QLatin1String("list"), QSqlDriver::FieldName) + QLatin1String(" = ?)");
+            return rs;
+
+        case Placeholders:
+            break;
+    }
+
     rs += QWhere::conditionStr(QWhere::In) + QLatin1String("(");
 
     for (int i=0; i<_list.count(); ++i)
@@ -221,9 +468,122 @@ QString QFInWherePrivate::sql(QSqlDriver *driver) const
     return rs;
 }
 
-void QFInWherePrivate::bindValues(QVariantList &values) const
+void QFInWherePrivate::bindValues(QVariantList &values, QSqlDriver *driver) const
 {
-    values << _list;
+    switch (mode(driver))
+    {
+        case Array:
+            values.append(arrayLiteral());
+            break;
+
+        case TemporaryTable:
+        {
+            // The values are in the table, only its rows of this list are read
+            QMutexLocker locker(&_sets_mutex);
+
+            values.append(_sets.value(driver).id);
+            break;
+        }
+
+        case Placeholders:
+            values << _list;
+            break;
+    }
+}
+
+bool QFInWherePrivate::setUp(const QSqlDatabase &db) const
+{
+    QSqlDriver *driver = db.driver();
+
+    if (mode(driver) != TemporaryTable)
+        return true;
+
+    // The statements using a copy of the filter on the connection share its rows
+    QMutexLocker locker(&_sets_mutex);
+    QHash<QSqlDriver *, LoadedSet>::iterator it = _sets.find(driver);
+
+    if (it != _sets.end())
+    {
+        it.value().users++;
+        return true;
+    }
+
+    QString table = tableName(driver);
+    QString list = driver->escapeIdentifier(QLatin1String("list"), QSqlDriver::FieldName);
+    QString column = driver->escapeIdentifier(QLatin1String("value"), QSqlDriver::FieldName);
+    QSqlQuery query(db);
+    LoadedSet set;
+
+    set.id = in_list_sets.fetchAndAddRelaxed(1) + 1;
+    set.users = 1;
+
+    // The table stays until the connection is closed, emptied by tearDown()
+    if (!query.exec("CREATE TEMPORARY TABLE IF NOT EXISTS " + table + " (" + list + " BIGINT, " + column + " " + columnType() + ")"))
+    {
+        qDebug() << "Cannot create the temporary table" << table << ":" << query.lastError();
+        return false;
+    }
+
+    // Multi-row inserts, in chunks
+    for (int first=0; first<_list.count(); first += IN_LIST_INSERT_ROWS)
+    {
+        int rows = qMin(IN_LIST_INSERT_ROWS, _list.count() - first);
+        QString sql = "INSERT INTO " + table + " (" + list + ", " + column + ") VALUES (?, ?)";
+        QVariantList values;
+
+        sql += QString(QLatin1String(", (?, ?)")).repeated(rows - 1);
+
+        for (int i=first; i<first + rows; ++i)
+            values << set.id << _list.at(i);
+
+        // Not cached: the last chunk can have any number of rows
+        QSqlQuery insert(db);
+
+        if (!insert.prepare(sql) || !QtOrmDatabase::execQuery(insert, db, values))
+        {
+            qDebug() << "Cannot fill the temporary table" << table << ":" << insert.lastError();
+
+            query.exec("DELETE FROM " + table + " WHERE " + list + " = " + QString::number(set.id));
+            return false;
+        }
+    }
+
+    // Released by tearDown(), a reconnection would drop the table
+    QtOrmDatabase::holdConnection(db);
+    _sets.insert(driver, set);
+
+    return true;
+}
+
+void QFInWherePrivate::tearDown(const QSqlDatabase &db) const
+{
+    QSqlDriver *driver = db.driver();
+
+    if (mode(driver) != TemporaryTable)
+        return;
+
+    QMutexLocker locker(&_sets_mutex);
+    QHash<QSqlDriver *, LoadedSet>::iterator it = _sets.find(driver);
+
+    // Another statement of the connection still reads the rows
+    if (it == _sets.end() || --it.value().users > 0)
+        return;
+
+    QSqlQuery query(db);
+    QString sql = "DELETE FROM " + tableName(driver) + " WHERE " +
+                  driver->escapeIdentifier(QLatin1String("list"), QSqlDriver::FieldName) + " = " +
+                  QString::number(it.value().id);
+
+    if (!query.exec(sql))
+        qDebug() << "Cannot empty a temporary table :" << query.lastError();
+
+    _sets.erase(it);
+    QtOrmDatabase::releaseConnection(db);
+}
+
+qint64 QFInWherePrivate::heapSize() const
+{
+    return sizeof(*this) + qtormHeapSize(_list);
 }
 
 QFInWhere::QFInWhere(const QField &left, const QVariantList &right)
@@ -241,7 +601,8 @@ class QFLikeWherePrivate : public QWherePrivate
         ~QFLikeWherePrivate();
 
         QString sql(QSqlDriver *driver) const;
-        void bindValues(QVariantList &values) const;
+        void bindValues(QVariantList &values, QSqlDriver *driver) const;
+        qint64 heapSize() const;
 
     private:
         QField _f;
@@ -266,11 +627,18 @@ QString QFLikeWherePrivate::sql(QSqlDriver *driver) const
     return rs;
 }
 
-void QFLikeWherePrivate::bindValues(QVariantList &values) const
+void QFLikeWherePrivate::bindValues(QVariantList &values, QSqlDriver *driver) const
 {
+    (void) driver;
+
     values.append(_pattern);
 }
 
+qint64 QFLikeWherePrivate::heapSize() const
+{
+    return sizeof(*this) + qtormHeapSize(_pattern);
+}
+
 QFLikeWhere::QFLikeWhere(const QField &left, const QString &right)
 : QWhere(new QFLikeWherePrivate(left, right))
 {
@@ -287,7 +655,8 @@ class QFDivWherePrivate : public QWherePrivate
         ~QFDivWherePrivate();
 
         QString sql(QSqlDriver *driver) const;
-        void bindValues(QVariantList &values) const;
+        void bindValues(QVariantList &values, QSqlDriver *driver) const;
+        qint64 heapSize() const;
 
     private:
         QField _f;
@@ -309,12 +678,19 @@ QString QFDivWherePrivate::sql(QSqlDriver *driver) const
     return QString("((%1 + ?) % ? = 0)").arg(fieldName(_f, driver));
 }
 
-void QFDivWherePrivate::bindValues(QVariantList &values) const
+void QFDivWherePrivate::bindValues(QVariantList &values, QSqlDriver *driver) const
 {
+    (void) driver;
+
     values.append(_offset);
     values.append(_divisor);
 }
 
+qint64 QFDivWherePrivate::heapSize() const
+{
+    return sizeof(*this);
+}
+
 QFDivWhere::QFDivWhere(const QField &left, int divisor, int offset)
 : QWhere(new QFDivWherePrivate(left, divisor, offset))
 {
@@ -330,7 +706,8 @@ class QFFlagSetWherePrivate : public QWherePrivate
         ~QFFlagSetWherePrivate();
 
         QString sql(QSqlDriver *driver) const;
-        void bindValues(QVariantList &values) const;
+        void bindValues(QVariantList &values, QSqlDriver *driver) const;
+        qint64 heapSize() const;
 
     private:
         QField _f;
@@ -351,11 +728,18 @@ QString QFFlagSetWherePrivate::sql(QSqlDriver *driver) const
     return QString("((%1 & ?) != 0)").arg(fieldName(_f, driver));
 }
 
-void QFFlagSetWherePrivate::bindValues(QVariantList &values) const
+void QFFlagSetWherePrivate::bindValues(QVariantList &values, QSqlDriver *driver) const
 {
+    (void) driver;
+
     values.append(_flag);
 }
 
+qint64 QFFlagSetWherePrivate::heapSize() const
+{
+    return sizeof(*this);
+}
+
 QFFlagSetWhere::QFFlagSetWhere(const QField &left, int flag)
 : QWhere(new QFFlagSetWherePrivate(left, flag))
 {
@@ -371,7 +755,8 @@ class QFNullWherePrivate : public QWherePrivate
         ~QFNullWherePrivate();
 
         QString sql(QSqlDriver *driver) const;
-        void bindValues(QVariantList &values) const;
+        void bindValues(QVariantList &values, QSqlDriver *driver) const;
+        qint64 heapSize() const;
 
     private:
         QField _f;
@@ -391,11 +776,18 @@ QString QFNullWherePrivate::sql(QSqlDriver *driver) const
     return QString("%1 IS NULL").arg(fieldName(_f, driver));
 }
 
-void QFNullWherePrivate::bindValues(QVariantList &values) const
+void QFNullWherePrivate::bindValues(QVariantList &values, QSqlDriver *driver) const
 {
+    (void) driver;
+
     (void) values;
 }
 
+qint64 QFNullWherePrivate::heapSize() const
+{
+    return sizeof(*this);
+}
+
 QFNullWhere::QFNullWhere(const QField &left)
 : QWhere(new QFNullWherePrivate(left))
 {
@@ -412,7 +804,8 @@ class QFIWherePrivate : public QWherePrivate
         ~QFIWherePrivate();
 
         QString sql(QSqlDriver *driver) const;
-        void bindValues(QVariantList &values) const;
+        void bindValues(QVariantList &values, QSqlDriver *driver) const;
+        qint64 heapSize() const;
 
     private:
         QField _f;
@@ -438,11 +831,18 @@ QString QFIWherePrivate::sql(QSqlDriver *driver) const
     return rs;
 }
 
-void QFIWherePrivate::bindValues(QVariantList &values) const
+void QFIWherePrivate::bindValues(QVariantList &values, QSqlDriver *driver) const
 {
+    (void) driver;
+
     values.append(_value);
 }
 
+qint64 QFIWherePrivate::heapSize() const
+{
+    return sizeof(*this) + qtormHeapSize(_value);
+}
+
 QFIWhere::QFIWhere(const QField &left, const QVariant &right, Condition cond)
 : QWhere(new QFIWherePrivate(left, right, cond))
 {
@@ -459,7 +859,8 @@ class QFFWherePrivate : public QWherePrivate
         ~QFFWherePrivate();
 
         QString sql(QSqlDriver *driver) const;
-        void bindValues(QVariantList &values) const;
+        void bindValues(QVariantList &values, QSqlDriver *driver) const;
+        qint64 heapSize() const;
 
     private:
         QField _left;
@@ -485,12 +886,19 @@ QString QFFWherePrivate::sql(QSqlDriver *driver) const
     return rs;
 }
 
-void QFFWherePrivate::bindValues(QVariantList &values) const
+void QFFWherePrivate::bindValues(QVariantList &values, QSqlDriver *driver) const
 {
+    (void) driver;
+
     (void) values;
     return;
 }
 
+qint64 QFFWherePrivate::heapSize() const
+{
+    return sizeof(*this);
+}
+
 QFFWhere::QFFWhere(const QField &left, const QField &right, Condition cond)
 : QWhere(new QFFWherePrivate(left, right, cond))
 {
@@ -507,7 +915,12 @@ class QWWWherePrivate : public QWherePrivate
         ~QWWWherePrivate();
 
         QString sql(QSqlDriver *driver) const;
-        void bindValues(QVariantList &values) const;
+        void bindValues(QVariantList &values, QSqlDriver *driver) const;
+        qint64 heapSize() const;
+        bool hasSubquery() const;
+
+        bool setUp(const QSqlDatabase &db) const;
+        void tearDown(const QSqlDatabase &db) const;
 
     private:
         QWhere _left;
@@ -537,10 +950,41 @@ QString QWWWherePrivate::sql(QSqlDriver *driver) const
     return rs;
 }
 
-void QWWWherePrivate::bindValues(QVariantList &values) const
+void QWWWherePrivate::bindValues(QVariantList &values, QSqlDriver *driver) const
+{
+    _left.bindValues(values, driver);
+    _right.bindValues(values, driver);
+}
+
+qint64 QWWWherePrivate::heapSize() const
+{
+    return sizeof(*this) + _left.heapSize() + _right.heapSize();
+}
+
+bool QWWWherePrivate::hasSubquery() const
 {
-    _left.bindValues(values);
-    _right.bindValues(values);
+    return _left.hasSubquery() || _right.hasSubquery();
+}
+
+bool QWWWherePrivate::setUp(const QSqlDatabase &db) const
+{
+    // Nothing stays set up when it fails
+    if (!_left.setUp(db))
+        return false;
+
+    if (!_right.setUp(db))
+    {
+        _left.tearDown(db);
+        return false;
+    }
+
+    return true;
+}
+
+void QWWWherePrivate::tearDown(const QSqlDatabase &db) const
+{
+    _left.tearDown(db);
+    _right.tearDown(db);
 }
 
 QWWWhere::QWWWhere(const QWhere &left, const QWhere &right, Condition cond)
@@ -559,7 +1003,12 @@ class QWWherePrivate : public QWherePrivate
         ~QWWherePrivate();
 
         QString sql(QSqlDriver *driver) const;
-        void bindValues(QVariantList &values) const;
+        void bindValues(QVariantList &values, QSqlDriver *driver) const;
+        qint64 heapSize() const;
+        bool hasSubquery() const;
+
+        bool setUp(const QSqlDatabase &db) const;
+        void tearDown(const QSqlDatabase &db) const;
 
     private:
         QWhere _w;
@@ -585,9 +1034,29 @@ QString QWWherePrivate::sql(QSqlDriver *driver) const
     return rs;
 }
 
-void QWWherePrivate::bindValues(QVariantList &values) const
+void QWWherePrivate::bindValues(QVariantList &values, QSqlDriver *driver) const
+{
+    _w.bindValues(values, driver);
+}
+
+qint64 QWWherePrivate::heapSize() const
 {
-    _w.bindValues(values);
+    return sizeof(*this) + _w.heapSize();
+}
+
+bool QWWherePrivate::hasSubquery() const
+{
+    return _w.hasSubquery();
+}
+
+bool QWWherePrivate::setUp(const QSqlDatabase &db) const
+{
+    return _w.setUp(db);
+}
+
+void QWWherePrivate::tearDown(const QSqlDatabase &db) const
+{
+    _w.tearDown(db);
 }
 
 QWWhere::QWWhere(const QWhere &w, Condition cond)
@@ -606,7 +1075,8 @@ class QFWherePrivate : public QWherePrivate
         ~QFWherePrivate();
 
         QString sql(QSqlDriver *driver) const;
-        void bindValues(QVariantList &values) const;
+        void bindValues(QVariantList &values, QSqlDriver *driver) const;
+        qint64 heapSize() const;
 
     private:
         QField _f;
@@ -630,13 +1100,186 @@ QString QFWherePrivate::sql(QSqlDriver *driver) const
     return rs;
 }
 
-void QFWherePrivate::bindValues(QVariantList &values) const
+void QFWherePrivate::bindValues(QVariantList &values, QSqlDriver *driver) const
 {
+    (void) driver;
+
     (void) values;
     return;
 }
 
+qint64 QFWherePrivate::heapSize() const
+{
+    return sizeof(*this);
+}
+
 QFWhere::QFWhere(const QField &f, Condition cond)
 : QWhere(new QFWherePrivate(f, cond))
 {
 }
+
+/*
+ * QFSubqueryWhere
+ */
+
+class QFSubqueryWherePrivate : public QWherePrivate
+{
+    public:
+        QFSubqueryWherePrivate(const QField &left, QQuerySetPrivate *subquery, QWhere::Condition cond);
+        ~QFSubqueryWherePrivate();
+
+        QString sql(QSqlDriver *driver) const;
+        void bindValues(QVariantList &values, QSqlDriver *driver) const;
+        qint64 heapSize() const;
+        bool hasSubquery() const;
+
+        bool setUp(const QSqlDatabase &db) const;
+        void tearDown(const QSqlDatabase &db) const;
+
+    private:
+        QField _f;
+        QQuerySetPrivate *_subquery;
+};
+
+QFSubqueryWherePrivate::QFSubqueryWherePrivate(const QField &left, QQuerySetPrivate *subquery, QWhere::Condition cond)
+: QWherePrivate(cond), _f(left), _subquery(subquery)
+{
+    _subquery->ref();
+}
+
+QFSubqueryWherePrivate::~QFSubqueryWherePrivate()
+{
+    if (!_subquery->deref())
+        delete _subquery;
+}
+
+QString QFSubqueryWherePrivate::sql(QSqlDriver *driver) const
+{
+    QString rs(fieldName(_f, driver));
+
+    rs += QWhere::conditionStr(condition());
+    rs += '(';
+    rs += _subquery->subquerySql(driver);
+    rs += ')';
+
+    return rs;
+}
+
+void QFSubqueryWherePrivate::bindValues(QVariantList &values, QSqlDriver *driver) const
+{
+    (void) driver;
+
+    // The values of the subquery are at the place of its SQL
+    _subquery->bindValues(values);
+}
+
+qint64 QFSubqueryWherePrivate::heapSize() const
+{
+    // The subquery belongs to the application
+    return sizeof(*this);
+}
+
+bool QFSubqueryWherePrivate::hasSubquery() const
+{
+    return true;
+}
+
+bool QFSubqueryWherePrivate::setUp(const QSqlDatabase &db) const
+{
+    return _subquery->setUpFilters(db);
+}
+
+void QFSubqueryWherePrivate::tearDown(const QSqlDatabase &db) const
+{
+    _subquery->tearDownFilters(db);
+}
+
+QFSubqueryWhere::QFSubqueryWhere(const QField &left, QQuerySet &subquery, Condition cond)
+: QWhere(new QFSubqueryWherePrivate(left, subquery.d, cond))
+{
+}
+
+/*
+ * QExistsWhere
+ */
+
+class QExistsWherePrivate : public QWherePrivate
+{
+    public:
+        QExistsWherePrivate(QQuerySetPrivate *subquery, bool owned, QWhere::Condition cond);
+        ~QExistsWherePrivate();
+
+        QString sql(QSqlDriver *driver) const;
+        void bindValues(QVariantList &values, QSqlDriver *driver) const;
+        qint64 heapSize() const;
+        bool hasSubquery() const;
+
+        bool setUp(const QSqlDatabase &db) const;
+        void tearDown(const QSqlDatabase &db) const;
+
+    private:
+        QQuerySetPrivate *_subquery;
+        bool _owned;                // Created for the filter, not by the application
+};
+
+QExistsWherePrivate::QExistsWherePrivate(QQuerySetPrivate *subquery, bool owned, QWhere::Condition cond)
+: QWherePrivate(cond), _subquery(subquery), _owned(owned)
+{
+    // An owned subquery comes with its reference
+    if (!_owned)
+        _subquery->ref();
+}
+
+QExistsWherePrivate::~QExistsWherePrivate()
+{
+    if (!_subquery->deref())
+        delete _subquery;
+}
+
+QString QExistsWherePrivate::sql(QSqlDriver *driver) const
+{
+    QString rs(QWhere::conditionStr(condition()));
+
+    rs += '(';
+    rs += _subquery->subquerySql(driver);
+    rs += ')';
+
+    return rs;
+}
+
+void QExistsWherePrivate::bindValues(QVariantList &values, QSqlDriver *driver) const
+{
+    (void) driver;
+
+    _subquery->bindValues(values);
+}
+
+qint64 QExistsWherePrivate::heapSize() const
+{
+    return sizeof(*this) + (_owned ? _subquery->heapSize() : 0);
+}
+
+bool QExistsWherePrivate::hasSubquery() const
+{
+    return true;
+}
+
+bool QExistsWherePrivate::setUp(const QSqlDatabase &db) const
+{
+    return _subquery->setUpFilters(db);
+}
+
+void QExistsWherePrivate::tearDown(const QSqlDatabase &db) const
+{
+    _subquery->tearDownFilters(db);
+}
+
+QExistsWhere::QExistsWhere(QQuerySet &subquery, Condition cond)
+: QWhere(new QExistsWherePrivate(subquery.d, false, cond))
+{
+}
+
+QFExistsWhere::QFExistsWhere(const QField &left, const QField &foreignKey, const QWhere &cond, Condition exists)
+: QWhere(new QExistsWherePrivate(QWherePrivate::relatedQuerySet(left, foreignKey, cond), true, exists))
+{
+}
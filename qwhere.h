@@ -27,6 +27,8 @@
 
 class QField;
 class QWherePrivate;
+class QQuerySet;
+class QSqlDatabase;
 
 class QSqlDriver;
 
@@ -46,7 +48,17 @@ class QWhere
             And,
             Or,
             Not,
-            Like
+            Like,
+            NotIn,
+            Exists,
+            NotExists
+        };
+
+        enum InListStrategy
+        {
+            InPlaceholders,     /*!< @brief One placeholder per value, whatever the size of the list */
+            InTemporaryTable,   /*!< @brief Above the threshold, load the values in a temporary table */
+            InAutomatic         /*!< @brief Above the threshold, bind an array on PostgreSQL and use a temporary table elsewhere */
         };
 
     public:
@@ -61,15 +73,7 @@ class QWhere
             d = other.d; other.d = nullptr;
         }
 
-        inline QWhere &operator=(QWhere &&other)
-        {
-            if (this != &other)
-            {
-                d = other.d;
-                other.d = nullptr;
-            }
-            return *this;
-        }
+        QWhere &operator=(QWhere &&other);
 #endif
 
         bool isValid() const;
@@ -81,9 +85,26 @@ class QWhere
 
         static QString conditionStr(Condition cond);
 
+        /**
+         * @brief Choose how QF::in() sends lists of more than threshold values
+         *
+         * Large lists hit the parameter limits of the engines, and parsing
+         * thousands of placeholders is slow. Temporary tables are created on
+         * the connection of the statement and dropped when it is finished.
+         */
+        static void setInListStrategy(InListStrategy strategy, int threshold = 500);
+
+        static QWhere exists(QQuerySet &subquery);       /*!< @brief True if the subquery returns a row, see QExistsWhere */
+        static QWhere notExists(QQuerySet &subquery);
+
     public:
         QString sql(QSqlDriver *driver) const;
-        void bindValues(QVariantList &values) const;
+        void bindValues(QVariantList &values, QSqlDriver *driver) const;
+        qint64 heapSize() const;   /*!< @brief Approximate heap bytes held by the expression tree */
+        bool hasSubquery() const;  /*!< @brief The expression contains a subquery, that may refer to the enclosing tables */
+
+        bool setUp(const QSqlDatabase &db) const;     /*!< @brief Run the statements the filter needs, before the one using it */
+        void tearDown(const QSqlDatabase &db) const;  /*!< @brief Clean up after setUp(), once the statement is finished */
 
     private:
         QWherePrivate *d;
@@ -149,4 +170,47 @@ class QFWhere : public QWhere
         QFWhere(const QField &f, Condition cond);
 };
 
+/**
+ * @brief Compare a field with the result of another queryset
+ *
+ * The subquery is generated and its values are bound when the enclosing
+ * statement is built and run. The filter keeps a reference to it, so the
+ * QQuerySet can be destroyed before the filter, but filters added to the
+ * subquery afterwards are used too. Generating it numbers the tables of its
+ * models, under a lock: its model must be another instance than the models
+ * of the enclosing queryset, and must not be used by other querysets.
+ */
+class QFSubqueryWhere : public QWhere
+{
+    public:
+        QFSubqueryWhere(const QField &left, QQuerySet &subquery, Condition cond);
+};
+
+/**
+ * @brief Test whether a subquery returns at least one row
+ *
+ * The subquery can refer to the fields of the enclosing queryset, for
+ * instance with QF(p.course->teacher) == t.pk(), so that the database
+ * evaluates it as a semi-join and stops at the first match. The same rules
+ * as for QFSubqueryWhere apply.
+ */
+class QExistsWhere : public QWhere
+{
+    public:
+        QExistsWhere(QQuerySet &subquery, Condition cond);
+};
+
+/**
+ * @brief Test whether rows of another model reference a field through a foreign key
+ *
+ * Generates EXISTS (SELECT ... FROM <model of foreignKey> WHERE foreignKey =
+ * left AND cond). The model of the foreign key must not be used by the
+ * enclosing queryset.
+ */
+class QFExistsWhere : public QWhere
+{
+    public:
+        QFExistsWhere(const QField &left, const QField &foreignKey, const QWhere &cond, Condition exists);
+};
+
 #endif
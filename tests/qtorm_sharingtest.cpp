@@ -0,0 +1,424 @@
+/*
+ * qtorm_sharingtest.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Stress test of the handles shared between threads: QWhere, QAssign and
+ * QField trees are built once, then copied, combined, destroyed and turned
+ * into SQL by several threads at once. Every thread must get the SQL and the
+ * values of the main thread, and the trees must survive the threads. Filters
+ * with subqueries are added to querysets of each thread, as their SQL
+ * depends on the enclosing statement.
+ *
+ * Every tenth iteration, the threads also run querysets using the shared
+ * trees (next(), count(), update() and remove()) on a fixture of their own
+ * in-memory database, and must find the rows the main thread found.
+ *
+ *   qtorm_sharingtest [--threads N] [--iterations N]
+ */
+
+#include "benchmodels.h"
+#include "qqueryset.h"
+#include "qtormdatabase.h"
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QThread>
+#include <QAtomicInt>
+#include <QtSql>
+#include <QtDebug>
+
+#include <stdio.h>
+
+static QAtomicInt failures;
+
+struct Shared
+{
+    QSqlDriver *driver;
+    QList<QWhere> filters;
+    QStringList filters_sql;
+    QList<int> filters_values;
+    QAssign assign;
+    QString assign_sql;
+    QField field;
+    QList<QWhere> subqueries;       // On Course
+    QStringList subqueries_sql;     // SELECT and DELETE of a Course queryset
+
+    // What running querysets with the trees gives in the main thread
+    QStringList filters_rows;
+    QStringList subqueries_rows;
+};
+
+static void populate(QSqlDatabase db)
+{
+    Teacher t;
+    Course c;
+    Pupil p;
+    QSqlQuery query(db);
+    QList<QVariant> teacher_ids, course_ids;
+
+    query.exec(t.createTableSql());
+    query.exec(c.createTableSql());
+    query.exec(p.createTableSql());
+
+    for (int i=0; i<3; ++i)
+    {
+        t.pk().setRawData(QVariant());
+        t.name = QString("teacher %1").arg(i);
+        t.save();
+        teacher_ids.append(t.pk().data());
+    }
+
+    for (int i=0; i<6; ++i)
+    {
+        c.pk().setRawData(QVariant());
+        c.name = QString("course %1").arg(i);
+        c.teacher = teacher_ids.at(i % 3);
+        c.save();
+        course_ids.append(c.pk().data());
+    }
+
+    for (int i=0; i<60; ++i)
+    {
+        p.pk().setRawData(QVariant());
+        p.name = QString("pupil %1").arg(i);
+        p.age = 6 + i % 12;
+        p.course = course_ids.at(i % 6);
+        p.save();
+    }
+}
+
+static QString runPupils(const QWhere &filter, const QAssign &assign)
+{
+    // Iterate, count and update the pupils matching filter, then undo the update
+    Pupil p, u;
+    QVariantList ids;
+    int count, updated = -1;
+
+    // Join the models the filters follow
+    p.course->teacher.value();
+    u.course->teacher.value();
+
+    {
+        QQuerySet q(&p);
+
+        q.addFilter(filter);
+
+        while (q.next())
+            ids.append(p.pk().data());
+    }
+
+    {
+        QQuerySet q(&p);
+
+        q.addFilter(filter);
+        count = q.count();
+    }
+
+    {
+        QQuerySet q(&u);
+
+        u.age = assign;
+        q.addFilter(filter);
+
+        if (!q.update(&updated))
+            updated = -1;
+    }
+
+    if (!ids.isEmpty())
+    {
+        Pupil undo;
+        QQuerySet q(&undo);
+
+        undo.age = QF(undo.age) - QVariant(1);
+        q.addFilter(QF(undo.pk()).in(ids));
+        q.update();
+    }
+
+    return QString("%1 rows, count %2, %3 updated").arg(ids.count()).arg(count).arg(updated);
+}
+
+static QString runCourses(const QWhere &filter)
+{
+    // Iterate and count the courses matching filter, and remove them in a rolled back transaction
+    Course c;
+    int rows = 0, count, removed = -1;
+
+    {
+        QQuerySet q(&c);
+
+        q.addFilter(filter);
+
+        while (q.next())
+            rows++;
+    }
+
+    {
+        QQuerySet q(&c);
+
+        q.addFilter(filter);
+        count = q.count();
+    }
+
+    QtOrmDatabase::transaction();
+
+    {
+        QQuerySet q(&c);
+
+        q.addFilter(filter);
+
+        if (!q.remove(&removed))
+            removed = -1;
+    }
+
+    QtOrmDatabase::rollback();
+
+    return QString("%1 rows, count %2, %3 removed").arg(rows).arg(count).arg(removed);
+}
+
+static QStringList subquerySql(const QWhere &filter)
+{
+    // The statements of a queryset using the filter
+    Course c;
+    QQuerySet select(&c), remove(&c);
+
+    select.addFilter(filter);
+    remove.addFilter(filter);
+
+    return QStringList() << select.sql() << remove.sql(true);
+}
+
+class SharingThread : public QThread
+{
+    public:
+        SharingThread(const Shared &shared, int iterations)
+         : _shared(shared), _iterations(iterations)
+        {
+        }
+
+    protected:
+        void run()
+        {
+            // Querysets need a connection of their own
+            QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", QString("qtorm_sharingtest_%1").arg(quintptr(this)));
+
+            db.setDatabaseName(":memory:");
+
+            if (!db.open())
+            {
+                fail("cannot open the database of a thread");
+                return;
+            }
+
+            QtOrmDatabase::setThreadDatabase(db);
+            populate(db);
+
+            for (int i=0; i<_iterations; ++i)
+            {
+                int n = i % _shared.filters.count();
+
+                // Copies and combinations of the shared trees
+                QWhere copy = _shared.filters.at(n);
+                QWhere combined = copy && _shared.filters.at(0);
+                QVariantList values;
+
+                if (copy.sql(_shared.driver) != _shared.filters_sql.at(n))
+                    fail(QString("filter %1 generated \"%2\"").arg(n).arg(copy.sql(_shared.driver)));
+
+                combined.bindValues(values, _shared.driver);
+
+                if (values.count() != _shared.filters_values.at(n) + _shared.filters_values.at(0))
+                    fail(QString("filter %1 bound %2 values").arg(n).arg(values.count()));
+
+                QAssign assign;
+
+                assign = _shared.assign;
+
+                if (assign.sql(_shared.driver) != _shared.assign_sql)
+                    fail(QString("assignation generated \"%1\"").arg(assign.sql(_shared.driver)));
+
+                QField field(_shared.field);
+                QField other;
+
+                other = field;
+                other = other;
+
+                int s = i % _shared.subqueries.count();
+                QStringList sql = subquerySql(_shared.subqueries.at(s));
+
+                if (sql != _shared.subqueries_sql.mid(2 * s, 2))
+                    fail(QString("subquery %1 generated \"%2\"").arg(s).arg(sql.join("\" and \"")));
+
+                if (i % 10 != 0)
+                    continue;
+
+                // Run the trees: prepare, bind, execute and tear down with another connection
+                n = (i / 10) % _shared.filters.count();
+                s = (i / 10) % _shared.subqueries.count();
+
+                QString rows = runPupils(_shared.filters.at(n), _shared.assign);
+
+                if (rows != _shared.filters_rows.at(n))
+                    fail(QString("filter %1 gave %2").arg(n).arg(rows));
+
+                rows = runCourses(_shared.subqueries.at(s));
+
+                if (rows != _shared.subqueries_rows.at(s))
+                    fail(QString("subquery %1 gave %2").arg(s).arg(rows));
+            }
+        }
+
+    private:
+        static void fail(const QString &message)
+        {
+            // Only report the first failures, there may be millions of them
+            if (failures.fetchAndAddOrdered(1) < 10)
+                qDebug() << "FAIL:" << message;
+        }
+
+    private:
+        const Shared &_shared;
+        int _iterations;
+};
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    int threads = 8;
+    int iterations = 20000;
+
+    for (int i=1; i<args.count(); ++i)
+    {
+        if (args.at(i) == "--threads" && i + 1 < args.count())
+            threads = args.at(++i).toInt();
+        else if (args.at(i) == "--iterations" && i + 1 < args.count())
+            iterations = args.at(++i).toInt();
+        else
+        {
+            fprintf(stderr, "Usage: %s [--threads N] [--iterations N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // The main thread has the same fixture as the other threads
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "qtorm_sharingtest");
+
+    db.setDatabaseName(":memory:");
+
+    if (!db.open())
+    {
+        qDebug() << "Cannot open the database :" << db.lastError();
+        return 1;
+    }
+
+    QtOrmDatabase::setPerThreadDatabase(true);
+    QtOrmDatabase::setThreadDatabase(db);
+    populate(db);
+
+    Pupil p;
+    Course c;
+    Pupil in_pupil, exists_pupil;
+    Shared shared;
+    QVariantList ids;
+
+    for (int i=0; i<50; ++i)
+        ids.append(i);
+
+    shared.driver = db.driver();
+    shared.filters.append(QF(p.age) == 10);
+    shared.filters.append((QF(p.age) >= 8 && QF(p.age) < 12) || QF(p.name).like("pupil 1%"));
+    shared.filters.append(QF(p.course->name) == QString("course 3") && !QF(p.course->teacher->name).isNull());
+    shared.filters.append(QF(p.pk()).in(ids));
+    shared.assign = QF(p.age) + QVariant(1);
+    shared.field = p.age;
+
+    {
+        // Number the tables of the prototype, the filter on p.course->name uses them
+        QQuerySet prototype(&p);
+
+        prototype.sql();
+    }
+
+    for (int i=0; i<shared.filters.count(); ++i)
+    {
+        QVariantList values;
+
+        shared.filters.at(i).bindValues(values, shared.driver);
+        shared.filters_sql.append(shared.filters.at(i).sql(shared.driver));
+        shared.filters_values.append(values.count());
+    }
+
+    shared.assign_sql = shared.assign.sql(shared.driver);
+
+    for (int i=0; i<shared.filters.count(); ++i)
+        shared.filters_rows.append(runPupils(shared.filters.at(i), shared.assign));
+
+    {
+        // The queryset is destroyed before the filter, that keeps it alive
+        QQuerySet older(&in_pupil);
+
+        older.addField(in_pupil.course);
+        older.addFilter(QF(in_pupil.age) > 16);
+        shared.subqueries.append(QF(c.pk()).in(older));
+    }
+
+    shared.subqueries.append(QF(c.pk()).exists(exists_pupil.course, QF(exists_pupil.age) > 16));
+
+    for (int i=0; i<shared.subqueries.count(); ++i)
+    {
+        shared.subqueries_sql += subquerySql(shared.subqueries.at(i));
+        shared.subqueries_rows.append(runCourses(shared.subqueries.at(i)));
+    }
+
+    QList<SharingThread *> workers;
+
+    for (int i=0; i<threads; ++i)
+        workers.append(new SharingThread(shared, iterations));
+
+    for (int i=0; i<threads; ++i)
+        workers.at(i)->start();
+
+    for (int i=0; i<threads; ++i)
+    {
+        workers.at(i)->wait();
+        delete workers.at(i);
+    }
+
+    // The shared trees must still be intact
+    for (int i=0; i<shared.filters.count(); ++i)
+    {
+        if (shared.filters.at(i).sql(shared.driver) != shared.filters_sql.at(i))
+            failures.ref();
+    }
+
+    for (int i=0; i<shared.subqueries.count(); ++i)
+    {
+        if (subquerySql(shared.subqueries.at(i)) != shared.subqueries_sql.mid(2 * i, 2))
+            failures.ref();
+    }
+
+    int failed = failures;
+
+    printf("%s: %d threads, %d iterations, %d failures\n", failed ? "FAIL" : "PASS", threads, iterations, failed);
+
+    return failed ? 1 : 0;
+}
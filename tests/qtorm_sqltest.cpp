@@ -0,0 +1,905 @@
+/*
+ * qtorm_sqltest.cpp
+ * This file is part of QtORM
+ *
+ * Copyright (C) 2012 - Denis Steckelmacher <steckdenis@yahoo.fr>
+ *
+ * QtORM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtORM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Statements run against an in-memory SQLite database: each case modifies
+ * the rows of a small fixture with update() or remove(), and the resulting
+ * rows are read back with plain SQL, or reads the fixture with next() and
+ * the relations of the models.
+ *
+ *   qtorm_sqltest
+ */
+
+#include "benchmodels.h"
+#include "qqueryset.h"
+#include "qtormdatabase.h"
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QtSql>
+#include <QtDebug>
+
+#include <stdio.h>
+
+/*
+ * Driver that looks like QPSQL, its handle is a PGconn, for the statements
+ * that cannot run on SQLite. It is only used to generate SQL.
+ */
+
+struct pg_conn;
+typedef struct pg_conn PGconn;
+
+Q_DECLARE_METATYPE(PGconn *)
+
+class StubResult : public QSqlResult
+{
+    public:
+        StubResult(const QSqlDriver *driver) : QSqlResult(driver) {}
+
+    protected:
+        QVariant data(int) { return QVariant(); }
+        bool isNull(int) { return true; }
+        bool reset(const QString &) { return true; }
+        bool fetch(int) { return false; }
+        bool fetchFirst() { return false; }
+        bool fetchLast() { return false; }
+        int size() { return 0; }
+        int numRowsAffected() { return 0; }
+};
+
+class PostgresDriver : public QSqlDriver
+{
+    public:
+        bool hasFeature(DriverFeature feature) const
+        {
+            return feature == PreparedQueries || feature == PositionalPlaceholders;
+        }
+
+        bool open(const QString &, const QString &, const QString &, const QString &, int, const QString &)
+        {
+            return false;
+        }
+
+        void close()
+        {
+        }
+
+        QSqlResult *createResult() const
+        {
+            return new StubResult(this);
+        }
+
+        QVariant handle() const
+        {
+            return qVariantFromValue((PGconn *)0);
+        }
+};
+
+/*
+ * Many-to-many relation of the tests: a club has pupils as members
+ */
+
+struct Club;
+
+struct Membership : public QModel
+{
+    Membership();
+
+    QForeignKey<Club> club;
+    QForeignKey<Pupil> pupil;
+};
+
+struct Club : public QModel
+{
+    Club();
+
+    QStringField name;
+    QManyToMany<Pupil> members;
+};
+
+Membership::Membership() : QModel("test_membership")
+{
+    club = foreignKey<Club>("club");
+    pupil = foreignKey<Pupil>("pupil");
+
+    init();
+}
+
+Club::Club() : QModel("test_club")
+{
+    name = stringField("name");
+    members = manyToMany<Pupil, Membership>("club", "pupil");
+
+    init();
+}
+
+static int failures = 0;
+static QList<QVariant> teacher_ids, course_ids, pupil_ids;
+
+static void exec(QSqlDatabase db, const QString &sql)
+{
+    QSqlQuery query(db);
+
+    if (!query.exec(sql))
+        qDebug() << "Cannot run" << sql << ":" << query.lastError();
+}
+
+static void populate(QSqlDatabase db)
+{
+    Teacher t;
+    Course c;
+    Pupil p;
+
+    exec(db, "DROP TABLE IF EXISTS " + p.tableName());
+    exec(db, "DROP TABLE IF EXISTS " + c.tableName());
+    exec(db, "DROP TABLE IF EXISTS " + t.tableName());
+    exec(db, t.createTableSql());
+    exec(db, c.createTableSql());
+    exec(db, p.createTableSql());
+
+    teacher_ids.clear();
+    course_ids.clear();
+    pupil_ids.clear();
+
+    for (int i=0; i<2; ++i)
+    {
+        t.pk().setRawData(QVariant());
+        t.name = QString("teacher %1").arg(i);
+        t.save();
+        teacher_ids.append(t.pk().data());
+    }
+
+    // Courses 0 and 2 are given by teacher 0, course 1 by teacher 1
+    for (int i=0; i<3; ++i)
+    {
+        c.pk().setRawData(QVariant());
+        c.name = QString("course %1").arg(i);
+        c.teacher = teacher_ids.at(i % 2);
+        c.save();
+        course_ids.append(c.pk().data());
+    }
+
+    // Pupil i is 10 * (i + 1) years old and follows course i
+    for (int i=0; i<3; ++i)
+    {
+        p.pk().setRawData(QVariant());
+        p.name = QString("pupil %1").arg(i);
+        p.age = 10 * (i + 1);
+        p.course = course_ids.at(i);
+        p.save();
+        pupil_ids.append(p.pk().data());
+    }
+}
+
+static QString column(QSqlDatabase db, const QString &sql)
+{
+    // The values of the first column, comma-separated
+    QSqlQuery query(db);
+    QStringList rs;
+
+    if (!query.exec(sql))
+        return "error: " + query.lastError().text();
+
+    while (query.next())
+        rs.append(query.value(0).toString());
+
+    return rs.join(",");
+}
+
+static QString rows(QQuerySet &q, const QStringField &name)
+{
+    // The values of name in the rows returned by next(), comma-separated
+    QStringList rs;
+
+    while (q.next())
+        rs.append(name);
+
+    return rs.join(",");
+}
+
+static bool hasSqlite3(QSqlDatabase db, int minor)
+{
+    // The SQLite library used by the driver is at least 3.minor
+    QStringList version = column(db, "SELECT sqlite_version()").split(".");
+
+    if (version.count() < 2)
+        return false;
+
+    return version.at(0).toInt() > 3 || (version.at(0).toInt() == 3 && version.at(1).toInt() >= minor);
+}
+
+static void check(const char *name, const QString &got, const QString &expected)
+{
+    if (got == expected)
+    {
+        printf("PASS: %s\n", name);
+    }
+    else
+    {
+        printf("FAIL: %s: got \"%s\", expected \"%s\"\n", name, qPrintable(got), qPrintable(expected));
+        failures++;
+    }
+}
+
+/*
+ * Cases
+ */
+
+static void testUpdateRelatedFilter(QSqlDatabase db)
+{
+    // The assignation uses T0, the filter a joined model
+    Pupil p;
+
+    populate(db);
+
+    p.age = QF(p.age) + QVariant(1);
+
+    QQuerySet u(&p);
+
+    u.addFilter(QF(p.course->teacher) == teacher_ids.at(0));
+
+    check("update with a filter on a related model", u.update() ? QString("ok") : QString("failed"), "ok");
+    check("update with a filter on a related model, rows",
+          column(db, "SELECT age FROM " + p.tableName() + " ORDER BY name"), "11,20,31");
+}
+
+static void testRemoveExists(QSqlDatabase db)
+{
+    // The subquery refers to the deleted table, that must stay T0 in it
+    Course c;
+    Pupil p;
+
+    populate(db);
+
+    QQuerySet r(&c);
+
+    r.addFilter(QF(c.pk()).exists(p.course, QF(p.age) > 25));
+
+    check("remove with a correlated EXISTS", r.remove() ? QString("ok") : QString("failed"), "ok");
+    check("remove with a correlated EXISTS, rows",
+          column(db, "SELECT name FROM " + c.tableName() + " ORDER BY name"), "course 0,course 1");
+}
+
+static void testUpdateExists(QSqlDatabase db)
+{
+    Course c;
+    Pupil p;
+
+    populate(db);
+
+    c.name = QString("renamed");
+
+    QQuerySet u(&c);
+
+    u.addFilter(QF(c.pk()).exists(p.course, QF(p.age) > 15));
+
+    check("update with a correlated EXISTS", u.update() ? QString("ok") : QString("failed"), "ok");
+    check("update with a correlated EXISTS, rows",
+          column(db, "SELECT name FROM " + c.tableName() + " ORDER BY " + c.pk().name()), "course 0,renamed,renamed");
+}
+
+static void testUpdateExistsRelatedFilter(QSqlDatabase db)
+{
+    // The rows are selected in a subquery, in which the EXISTS is correlated
+    Course c;
+    Pupil p;
+
+    populate(db);
+
+    c.name = QString("renamed");
+
+    QQuerySet u(&c);
+
+    u.addFilter(QF(c.teacher->name) == QString("teacher 0"));
+    u.addFilter(QF(c.pk()).exists(p.course, QF(p.age) > 15));
+
+    check("update with a correlated EXISTS and a related filter", u.update() ? QString("ok") : QString("failed"), "ok");
+    check("update with a correlated EXISTS and a related filter, rows",
+          column(db, "SELECT name FROM " + c.tableName() + " ORDER BY " + c.pk().name()), "course 0,course 1,renamed");
+}
+
+static void testInSubquery(QSqlDatabase db)
+{
+    Course c;
+    Pupil p;
+
+    populate(db);
+
+    QQuerySet sub(&c);
+    QQuerySet q(&p);
+
+    sub.addFilter(QF(c.teacher) == teacher_ids.at(1));
+    q.addFilter(QF(p.course).in(sub));
+    q.addOrderBy(p.name, true);
+
+    check("IN subquery, rows", rows(q, p.name), "pupil 1");
+}
+
+static void testNotInSubquery(QSqlDatabase db)
+{
+    Course c;
+    Pupil p;
+
+    populate(db);
+
+    QQuerySet sub(&c);
+    QQuerySet q(&p);
+
+    sub.addFilter(QF(c.name) == QString("course 0"));
+    q.addFilter(QF(p.course).notIn(sub));
+    q.addOrderBy(p.name, true);
+
+    check("NOT IN subquery, rows", rows(q, p.name), "pupil 1,pupil 2");
+}
+
+static void testScalarSubquery(QSqlDatabase db)
+{
+    // The subquery selects another column than its primary key
+    Pupil other;
+    Pupil p;
+
+    populate(db);
+
+    QQuerySet sub(&other);
+    QQuerySet q(&p);
+
+    sub.addField(other.age);
+    sub.addFilter(QF(other.name) == QString("pupil 0"));
+    q.addFilter(QF(p.age) > sub);
+    q.addOrderBy(p.name, true);
+
+    check("scalar subquery, rows", rows(q, p.name), "pupil 1,pupil 2");
+}
+
+static void testSubqueryRelatedFilter(QSqlDatabase db)
+{
+    // Both the statement and its subquery join a related model, the tables of
+    // the subquery are numbered after the ones of the statement
+    Course c;
+    Pupil p;
+
+    populate(db);
+
+    QQuerySet sub(&c);
+    QQuerySet q(&p);
+
+    sub.addFilter(QF(c.teacher->name) == QString("teacher 0"));
+    q.addFilter(QF(p.course->name) != QString("course 0"));
+    q.addFilter(QF(p.course).in(sub));
+    q.addOrderBy(p.name, true);
+
+    check("IN subquery with related filters, rows", rows(q, p.name), "pupil 2");
+}
+
+static QVariantList ages(const QString &list)
+{
+    QVariantList rs;
+    QStringList values = list.split(",");
+
+    for (int i=0; i<values.count(); ++i)
+        rs.append(values.at(i).toInt());
+
+    return rs;
+}
+
+static void testInTemporaryTable(QSqlDatabase db)
+{
+    Pupil p;
+
+    populate(db);
+    QWhere::setInListStrategy(QWhere::InTemporaryTable, 2);
+
+    QQuerySet q(&p);
+
+    q.addFilter(QF(p.age).in(ages("10,30,99")));
+    q.addOrderBy(p.name, true);
+
+    check("IN list in a temporary table, SQL", q.sql().contains("qtorm_in_bigint") ? QString("ok") : q.sql(), "ok");
+    check("IN list in a temporary table, rows", rows(q, p.name), "pupil 0,pupil 2");
+    check("IN list in a temporary table, emptied", column(db, "SELECT COUNT(*) FROM qtorm_in_bigint"), "0");
+
+    QWhere::setInListStrategy(QWhere::InAutomatic);
+}
+
+static void testInTemporaryTableShared(QSqlDatabase db)
+{
+    // Two statements of the connection use copies of the same filter, the
+    // first one keeps reading its rows after the second is finished
+    Pupil p;
+
+    populate(db);
+    QWhere::setInListStrategy(QWhere::InTemporaryTable, 2);
+
+    QWhere filter = QF(p.age).in(ages("10,20,99"));
+    QQuerySet first(&p);
+    QQuerySet second(&p);
+    QStringList names;
+
+    first.addFilter(filter);
+    first.addOrderBy(p.name, true);
+    second.addFilter(filter);
+    second.addOrderBy(p.name, true);
+
+    if (first.next())
+        names.append(p.name);
+
+    check("shared IN list in a temporary table, second statement", rows(second, p.name), "pupil 0,pupil 1");
+
+    while (first.next())
+        names.append(p.name);
+
+    check("shared IN list in a temporary table, first statement", names.join(","), "pupil 0,pupil 1");
+    check("shared IN list in a temporary table, emptied", column(db, "SELECT COUNT(*) FROM qtorm_in_bigint"), "0");
+
+    QWhere::setInListStrategy(QWhere::InAutomatic);
+}
+
+static void testInAutomatic(QSqlDatabase db)
+{
+    // SQLite has no arrays, the values go in a temporary table above the
+    // threshold, and in placeholders up to it
+    Pupil p;
+
+    populate(db);
+    QWhere::setInListStrategy(QWhere::InAutomatic, 3);
+
+    QQuerySet large(&p);
+    QQuerySet small(&p);
+
+    large.addFilter(QF(p.age).in(ages("20,30,40,50")));
+    large.addOrderBy(p.name, true);
+    small.addFilter(QF(p.age).in(ages("20,30,40")));
+    small.addOrderBy(p.name, true);
+
+    check("automatic IN list above the threshold, SQL", large.sql().contains("qtorm_in_bigint") ? QString("ok") : large.sql(), "ok");
+    check("automatic IN list above the threshold, rows", rows(large, p.name), "pupil 1,pupil 2");
+    check("automatic IN list at the threshold, SQL", small.sql().contains("(?, ?, ?)") ? QString("ok") : small.sql(), "ok");
+    check("automatic IN list at the threshold, rows", rows(small, p.name), "pupil 1,pupil 2");
+
+    QWhere::setInListStrategy(QWhere::InAutomatic);
+}
+
+static void testInArray()
+{
+    // On PostgreSQL, the values are bound as a single array
+    PostgresDriver driver;
+    Pupil p;
+    QVariantList values;
+
+    QWhere::setInListStrategy(QWhere::InAutomatic, 2);
+
+    QWhere filter = QF(p.age).in(ages("10,20,30"));
+
+    filter.bindValues(values, &driver);
+
+    check("IN list in an array, SQL", filter.sql(&driver).endsWith(" = ANY(?)") ? QString("ok") : filter.sql(&driver), "ok");
+    check("IN list in an array, values", values.count() == 1 ? values.at(0).toString() : QString("%1 values").arg(values.count()), "{10,20,30}");
+
+    QWhere::setInListStrategy(QWhere::InAutomatic);
+}
+
+static void testCountBeforeAndAfterNext(QSqlDatabase db)
+{
+    // count() does not change the statement next() runs, whatever the order
+    Pupil p;
+
+    populate(db);
+
+    QQuerySet q(&p);
+
+    q.addFilter(QF(p.course->teacher) == teacher_ids.at(0));
+    q.addOrderBy(p.name, true);
+
+    check("count() before next() with a related filter", QString::number(q.count()), "2");
+    check("count() twice before next()", QString::number(q.count()), "2");
+    check("next() after count()", rows(q, p.name), "pupil 0,pupil 2");
+    check("count() after next() with a related filter", QString::number(q.count()), "2");
+}
+
+static void testCountDistinct(QSqlDatabase db)
+{
+    // Pupils 0 and 2 have the same teacher
+    Pupil p;
+
+    populate(db);
+
+    QQuerySet q(&p);
+    int rows = 0;
+
+    q.addField(p.course->teacher);
+    q.setDistinct();
+
+    check("count() with setDistinct()", QString::number(q.count()), "2");
+
+    while (q.next())
+        rows++;
+
+    check("next() with setDistinct()", QString::number(rows), "2");
+    check("count() with setDistinct() after next()", QString::number(q.count()), "2");
+}
+
+static void testDistinctOn(QSqlDatabase db)
+{
+    // SQLite has no DISTINCT ON, the first row of each group is kept with ROW_NUMBER()
+    Pupil p;
+
+    // ROW_NUMBER() appeared in SQLite 3.25
+    if (!hasSqlite3(db, 25))
+    {
+        printf("SKIP: addDistinctOn() needs SQLite 3.25\n");
+        return;
+    }
+
+    populate(db);
+
+    QQuerySet q(&p);
+
+    q.addOrderBy(p.age, false);
+    q.addDistinctOn(p.course->teacher);
+
+    check("count() with addDistinctOn()", QString::number(q.count()), "2");
+    check("addDistinctOn(), rows", rows(q, p.name), "pupil 2,pupil 1");
+}
+
+static void testLimitPerGroup(QSqlDatabase db)
+{
+    // The two youngest pupils of each teacher: pupils 0 and 2 for teacher 0,
+    // pupil 1 for teacher 1. They come back in the order of addOrderBy(),
+    // not group by group.
+    Pupil p;
+
+    if (!hasSqlite3(db, 25))
+    {
+        printf("SKIP: setLimitPerGroup() needs SQLite 3.25\n");
+        return;
+    }
+
+    populate(db);
+
+    QQuerySet q(&p);
+
+    q.addOrderBy(p.age, true);
+    q.setLimitPerGroup(p.course->teacher, 2);
+
+    check("setLimitPerGroup(), count", QString::number(q.count()), "3");
+    check("setLimitPerGroup(), rows", rows(q, p.name), "pupil 0,pupil 1,pupil 2");
+
+    QQuerySet first(&p);
+
+    first.addOrderBy(p.age, false);
+    first.setLimitPerGroup(p.course->teacher, 1);
+
+    check("setLimitPerGroup() of one row, rows", rows(first, p.name), "pupil 2,pupil 1");
+
+    // A lock or DISTINCT would be silently dropped, the statement is refused
+    QQuerySet locked(&p);
+
+    locked.setLimitPerGroup(p.course->teacher, 1);
+    locked.setLockMode(QQuerySet::LockForUpdate);
+
+    check("setLimitPerGroup() with a row lock, rows", rows(locked, p.name), "");
+
+    QQuerySet distinct(&p);
+
+    distinct.setLimitPerGroup(p.course->teacher, 1);
+    distinct.setDistinct();
+
+    check("setLimitPerGroup() with setDistinct(), count", QString::number(distinct.count()), "-1");
+}
+
+static QString children(const QList<Pupil *> &pupils)
+{
+    // The names of the children of a relation, comma-separated
+    QStringList rs;
+
+    for (int i=0; i<pupils.count(); ++i)
+        rs.append(pupils.at(i)->name);
+
+    return rs.join(",");
+}
+
+static void testPrefetchRelated(QSqlDatabase db)
+{
+    // Chunks of two courses, the third one is loaded by a second query.
+    // Course 0 has two pupils, that must not be mixed with the others.
+    Course c;
+    Pupil p;
+    QStringList loaded;
+
+    populate(db);
+
+    p.name = QString("pupil 3");
+    p.age = 40;
+    p.course = course_ids.at(0);
+    p.save();
+
+    QQuerySet q(&c);
+
+    q.addOrderBy(c.name, true);
+    q.addPrefetchRelated(c.pupils, 2);
+
+    while (q.next())
+        loaded.append(QString(c.name) + ":" + children(c.pupils.all()));
+
+    check("addPrefetchRelated(), children", loaded.join(";"),
+          "course 0:pupil 0,pupil 3;course 1:pupil 1;course 2:pupil 2");
+
+    // Without prefetching, the children of the current row are loaded on access
+    QQuerySet single(&c);
+    QStringList counts;
+
+    single.addOrderBy(c.name, true);
+
+    while (single.next())
+        counts.append(QString::number(c.pupils.count()));
+
+    check("reverse relation without prefetching, counts", counts.join(","), "2,1,1");
+}
+
+static void populateClubs(QSqlDatabase db, Club &chess, Club &drama)
+{
+    // Pupils 0 and 2 are in the chess club, pupil 1 in the drama club
+    Membership m;
+
+    populate(db);
+
+    exec(db, "DROP TABLE IF EXISTS " + m.tableName());
+    exec(db, "DROP TABLE IF EXISTS " + chess.tableName());
+    exec(db, chess.createTableSql());
+    exec(db, m.createTableSql());
+
+    chess.name = QString("chess");
+    chess.save();
+    drama.name = QString("drama");
+    drama.save();
+
+    chess.members.add(QVariantList() << pupil_ids.at(0) << pupil_ids.at(2));
+    drama.members.add(QVariantList() << pupil_ids.at(1));
+}
+
+static QString members(QSqlDatabase db, const Club &club)
+{
+    // The names of the pupils linked to club, read with plain SQL
+    Membership m;
+    Pupil p;
+
+    return column(db, QString("SELECT p.name FROM %1 m JOIN %2 p ON p.%3 = m.pupil WHERE m.club = %4 ORDER BY p.name")
+                          .arg(m.tableName()).arg(p.tableName()).arg(p.pk().name()).arg(club.pk().data().toString()));
+}
+
+static void testManyToMany(QSqlDatabase db)
+{
+    Club chess, drama;
+
+    populateClubs(db, chess, drama);
+
+    check("QManyToMany::add(), links", members(db, chess), "pupil 0,pupil 2");
+    check("QManyToMany, loaded targets", children(chess.members.all()), "pupil 0,pupil 2");
+
+    // Prefetched targets, in one query joining the membership to the pupils
+    Club club;
+    QQuerySet q(&club);
+    QStringList loaded;
+
+    q.addOrderBy(club.name, true);
+    q.addPrefetchRelated(club.members);
+
+    while (q.next())
+        loaded.append(QString(club.name) + ":" + children(club.members.all()));
+
+    check("QManyToMany, prefetched targets", loaded.join(";"), "chess:pupil 0,pupil 2;drama:pupil 1");
+
+    // The chess club has two pupils older than 5, and is returned once
+    QQuerySet older(&club);
+
+    older.addFilter(club.members.contains(QF(club.members.target()->age) > 5));
+    older.addOrderBy(club.name, true);
+
+    check("QManyToMany::contains(), rows", rows(older, club.name), "chess,drama");
+
+    QQuerySet oldest(&club);
+
+    oldest.addFilter(club.members.contains(QF(club.members.target()->age) > 25));
+
+    check("QManyToMany::contains() of one target, rows", rows(oldest, club.name), "chess");
+
+    // remove() deletes the given links only, and the targets are loaded again
+    check("QManyToMany::remove()", chess.members.remove(QVariantList() << pupil_ids.at(0)) ? QString("ok") : QString("failed"), "ok");
+    check("QManyToMany::remove(), links", members(db, chess), "pupil 2");
+    check("QManyToMany::remove(), other links", members(db, drama), "pupil 1");
+    check("QManyToMany::remove(), loaded targets", children(chess.members.all()), "pupil 2");
+}
+
+static void testManyToManyBatches(QSqlDatabase db)
+{
+    // A membership inserts two values, 499 links per INSERT: 1200 links
+    // take three of them, and none may be lost at the boundaries
+    Club chess, drama;
+    Membership m;
+    QVariantList targets;
+
+    populateClubs(db, chess, drama);
+
+    for (int i=0; i<1200; ++i)
+        targets.append(1000 + i);
+
+    check("QManyToMany::add() of 1200 links", drama.members.add(targets) ? QString("ok") : QString("failed"), "ok");
+
+    QString where = " FROM " + m.tableName() + " WHERE club = " + drama.pk().data().toString() + " AND pupil >= 1000";
+
+    check("QManyToMany::add() of 1200 links, count", column(db, "SELECT COUNT(DISTINCT pupil)" + where), "1200");
+    check("QManyToMany::add() of 1200 links, range", column(db, "SELECT MIN(pupil) || '-' || MAX(pupil)" + where), "1000-2199");
+    check("QManyToMany::add() of 1200 links, other club", members(db, chess), "pupil 0,pupil 2");
+}
+
+static void testManyToManyErrors(QSqlDatabase db)
+{
+    Club chess, drama, unsaved;
+
+    populateClubs(db, chess, drama);
+
+    // An unsaved club has no key to link
+    check("QManyToMany::add() on an unsaved model", unsaved.members.add(QVariantList() << pupil_ids.at(0)) ? QString("ok") : QString("failed"), "failed");
+    check("QManyToMany::remove() on an unsaved model", unsaved.members.remove(QVariantList() << pupil_ids.at(0)) ? QString("ok") : QString("failed"), "failed");
+
+    // The statements fail without the membership table
+    exec(db, "DROP TABLE " + Membership().tableName());
+
+    check("QManyToMany::add() of a failing INSERT", chess.members.add(QVariantList() << pupil_ids.at(1)) ? QString("ok") : QString("failed"), "failed");
+    check("QManyToMany::remove() of a failing DELETE", chess.members.remove(QVariantList() << pupil_ids.at(0)) ? QString("ok") : QString("failed"), "failed");
+}
+
+static QQuerySet *claimQuery(Pupil &p)
+{
+    // The youngest pupil that is not claimed yet
+    QQuerySet *q = new QQuerySet(&p);
+
+    p.name = QString("claimed");
+
+    q->addFilter(QF(p.name) != QString("claimed"));
+    q->addOrderBy(p.age, true);
+    q->setLimit(1);
+
+    return q;
+}
+
+static QString claimOne(int *claimed, QString *sql)
+{
+    Pupil p;
+    QQuerySet *q = claimQuery(p);
+    QStringList ages;
+
+    if (!q->claim())
+    {
+        delete q;
+        return "failed";
+    }
+
+    *sql = q->sql();
+
+    while (q->next())
+    {
+        ages.append(QString::number(p.age));
+
+        if (QString(p.name) == "claimed")
+            (*claimed)++;
+    }
+
+    delete q;
+
+    return ages.join(",");
+}
+
+static void testClaim(QSqlDatabase db)
+{
+    int claimed = 0;
+    QString sql;
+
+    // UPDATE ... RETURNING appeared in SQLite 3.35
+    if (!hasSqlite3(db, 35))
+    {
+        printf("SKIP: claim() needs SQLite 3.35\n");
+        return;
+    }
+
+    populate(db);
+
+    check("claim(), first row", claimOne(&claimed, &sql), "10");
+    check("claim(), second row", claimOne(&claimed, &sql), "20");
+    check("claim(), returned rows are claimed", QString::number(claimed), "2");
+    check("claim(), rows", column(db, "SELECT name FROM " + Pupil().tableName() + " ORDER BY age"), "claimed,claimed,pupil 2");
+
+    // SQLite serializes the writers, and has no row locks to skip
+    check("claim() on SQLite, SQL", sql.contains("RETURNING") && !sql.contains("FOR UPDATE") ? QString("ok") : sql, "ok");
+
+    check("claim(), third row", claimOne(&claimed, &sql), "30");
+    check("claim(), nothing left", claimOne(&claimed, &sql), "");
+}
+
+static void testClaimPostgresSql(QSqlDatabase db)
+{
+    // The statement is built before it is prepared, which fails without a
+    // server: only its SQL is checked
+    if (!QSqlDatabase::isDriverAvailable("QPSQL"))
+    {
+        printf("SKIP: the QPSQL driver is not available\n");
+        return;
+    }
+
+    QtOrmDatabase::setThreadDatabase(QSqlDatabase::addDatabase("QPSQL", "qtorm_sqltest_pg"));
+
+    Pupil p;
+    QQuerySet *q = claimQuery(p);
+
+    q->claim();
+
+    QString sql = q->sql();
+
+    delete q;
+    QtOrmDatabase::setThreadDatabase(db);
+
+    check("claim() on PostgreSQL, SQL", sql.contains("FOR UPDATE OF \"T0\" SKIP LOCKED) RETURNING") ? QString("ok") : sql, "ok");
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "qtorm_sqltest");
+
+    db.setDatabaseName(":memory:");
+
+    if (!db.open())
+    {
+        qDebug() << "Cannot open the database :" << db.lastError();
+        return 1;
+    }
+
+    QtOrmDatabase::setPerThreadDatabase(true);
+    QtOrmDatabase::setThreadDatabase(db);
+
+    testUpdateRelatedFilter(db);
+    testRemoveExists(db);
+    testUpdateExists(db);
+    testUpdateExistsRelatedFilter(db);
+    testInSubquery(db);
+    testNotInSubquery(db);
+    testScalarSubquery(db);
+    testSubqueryRelatedFilter(db);
+    testInTemporaryTable(db);
+    testInTemporaryTableShared(db);
+    testInAutomatic(db);
+    testInArray();
+    testCountBeforeAndAfterNext(db);
+    testCountDistinct(db);
+    testDistinctOn(db);
+    testClaim(db);
+    testClaimPostgresSql(db);
+    testLimitPerGroup(db);
+    testPrefetchRelated(db);
+    testManyToMany(db);
+    testManyToManyBatches(db);
+    testManyToManyErrors(db);
+
+    printf("%s: %d failures\n", failures ? "FAIL" : "PASS", failures);
+
+    return failures ? 1 : 0;
+}